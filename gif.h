@@ -0,0 +1,916 @@
+/*
+GIF data structures, parser and LZW decoder shared by the viewer and the tools
+
+The parser only walks the block structure of the file; LZW data of an image is left
+in place (Image::data_offset) and decoded on demand by decode_image() or by a Canvas.
+*/
+
+#ifndef GIF_H
+#define GIF_H
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+
+typedef enum BlockType
+{
+    BT_IMAGE = 0,
+    BT_GRAPHIC_CONTROL,
+    BT_APPLICATION_EXTENSION,
+    BT_COMMENT_BLOCK,
+    BT_OTHER_EXTENSION
+} BlockType;
+
+struct Color
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+};
+
+/* Base class for a "meaningful" block for GIF */
+class GIFBlock
+{
+public:
+    GIFBlock() = default;
+    GIFBlock(BlockType type_) : type(type_) {}
+    virtual ~GIFBlock() = default;
+
+    BlockType type;
+
+    size_t offset = 0; // where the block (introducer included) starts in the file
+    size_t length = 0; // size of the block in bytes
+};
+
+class Image : public GIFBlock
+{
+public:
+    Image() : GIFBlock(BT_IMAGE) {}
+
+    size_t width;
+    size_t height;
+    int left;
+    int top;
+    bool interlace;
+
+    bool local_ct; // ct comes from a local color table
+    std::vector<Color> ct;
+
+    size_t lzw_min;
+    size_t data_offset; // offset of the first LZW data sub-block in the file
+
+    std::vector<uint8_t> index; // filled by decode_image(), empty until then
+};
+
+class GraphicsControl : public GIFBlock
+{
+public:
+    GraphicsControl() : GIFBlock(BT_GRAPHIC_CONTROL) {}
+
+    bool transparent;
+    bool user_input;
+    uint8_t disposal_method;
+    int delay_time;
+    uint8_t color_index; /* for transparency */
+};
+
+class ApplicationExtension : public GIFBlock
+{
+public:
+    ApplicationExtension() : GIFBlock(BT_APPLICATION_EXTENSION) {}
+
+    char appid[8];
+    int8_t authcode[3];
+
+    std::vector<uint8_t> data; // data sub-blocks joined together
+};
+
+class CommentBlock : public GIFBlock
+{
+public:
+    CommentBlock() : GIFBlock(BT_COMMENT_BLOCK) {}
+
+    std::vector<std::string> comments;
+};
+
+/* Plain text extension, or one with an unknown label: only kept so that it can be copied */
+class OtherExtension : public GIFBlock
+{
+public:
+    OtherExtension() : GIFBlock(BT_OTHER_EXTENSION) {}
+
+    uint8_t label;
+};
+
+/* An image together with the graphic control extension that precedes it */
+struct Frame
+{
+    Image* image;
+
+    bool transparent;
+    uint8_t disposal_method;
+    int delay_time;
+    uint8_t trans_idx;
+
+    int start_time; // sum of the delay times of the frames before, in 1/100 s
+    bool keyframe; // the canvas after drawing this frame doesn't depend on earlier frames
+};
+
+struct GIF
+{
+    std::vector<uint8_t> bytes; // contents of the file
+
+    size_t canvas_width;
+    size_t canvas_height;
+
+    bool gct_flag;
+    uint8_t color_resolution;
+    int bkgd_color_idx;
+    std::vector<Color> gct;
+
+    int loop_count = -1; // from the NETSCAPE2.0 extension, 0 = forever, -1 = no extension
+
+    std::vector<std::unique_ptr<GIFBlock>> blocks;
+    std::vector<Frame> frames;
+};
+
+/* What can be learnt about a GIF without decoding it, see read_gif_info() */
+struct GIFInfo
+{
+    size_t canvas_width;
+    size_t canvas_height;
+    size_t frame_count;
+    int duration; // in 1/100 s
+    int loop_count; // 0 = forever, -1 = no NETSCAPE2.0 extension
+};
+
+const std::string block_type_str[5] = {
+    "IMAGE",
+    "GRAPHIC CONTROL",
+    "APPLICATION EXTENSION",
+    "COMMENT EXTENSION",
+    "OTHER EXTENSION"
+};
+
+const std::string disposal_method_str[4] = {
+    "disposal method not specified",
+    "do not dispose of graphic",
+    "overwrite graphic with background color",
+    "overwrite graphic with previous graphic"
+};
+
+inline bool get_bit(int8_t n, int p)
+{
+    return (n & (1 << (p))) != 0;
+}
+
+/* retrieve value from n starting from bit position p with length l (e.g. ge_val(0b10010001, 4, 4) = 0b1001) */
+inline int8_t get_val(int8_t n, int p, int l)
+{
+    return (n >> p) & ((1 << l) - 1);
+}
+
+template<typename T>
+std::string HexToString(T uval)
+{
+    std::stringstream ss;
+    ss << "0x" << std::setw(sizeof(uval) * 2) << std::setfill('0') << std::hex << +uval;
+    return ss.str();
+}
+
+inline uint32_t color_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+/* Number in a command line spec; false unless all of s is a finite number */
+inline bool parse_float(const std::string& s, float& value)
+{
+    char* end;
+    value = std::strtof(s.c_str(), &end);
+
+    return !s.empty() && *end == '\0' && std::isfinite(value);
+}
+
+/* Color in a command line spec as RRGGBB */
+inline bool parse_rgb(const std::string& s, Color& c)
+{
+    char* end;
+    unsigned long rgb = std::strtoul(s.c_str(), &end, 16);
+
+    if (s.empty() || *end != '\0' || rgb > 0xFFFFFF)
+    {
+        return false;
+    }
+
+    c = Color{uint8_t(rgb >> 16), uint8_t(rgb >> 8), uint8_t(rgb)};
+    return true;
+}
+
+inline bool read_file(const char* path, std::vector<uint8_t>& bytes)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file)
+    {
+        return false;
+    }
+
+    file.seekg(0, file.end);
+    size_t length = file.tellg();
+    file.seekg(0, file.beg);
+
+    bytes.resize(length);
+
+    if (length > 0)
+    {
+        file.read(reinterpret_cast<char*>(bytes.data()), length);
+    }
+
+    return true;
+}
+
+/* Concatenate the data sub-blocks starting at idx into out; returns the index past the block terminator */
+inline size_t read_sub_blocks(const std::vector<uint8_t>& bytes, size_t idx, std::vector<uint8_t>& out)
+{
+    out.clear();
+
+    while (idx < bytes.size())
+    {
+        size_t nbytes = bytes[idx++]; // size of a data sub-block
+
+        if (nbytes == 0)
+        {
+            break;
+        }
+
+        if (idx + nbytes > bytes.size())
+        {
+            nbytes = bytes.size() - idx; // truncated file
+        }
+
+        out.insert(out.end(), bytes.begin() + idx, bytes.begin() + idx + nbytes);
+        idx += nbytes;
+    }
+
+    return idx;
+}
+
+/* Skip the data sub-blocks starting at idx using their length bytes; returns the index past the block terminator */
+inline size_t skip_sub_blocks(const std::vector<uint8_t>& bytes, size_t idx)
+{
+    while (idx < bytes.size())
+    {
+        size_t nbytes = bytes[idx++];
+
+        if (nbytes == 0)
+        {
+            break;
+        }
+
+        idx += nbytes;
+    }
+
+    return idx;
+}
+
+/* Loop count stored in a NETSCAPE2.0 (or ANIMEXTS1.0) application extension sub-block, or -1 */
+inline int netscape_loop_count(const char* appid, const uint8_t* data, size_t nbytes)
+{
+    bool netscape = std::memcmp(appid, "NETSCAPE", 8) == 0 || std::memcmp(appid, "ANIMEXTS", 8) == 0;
+
+    if (!netscape || nbytes < 3 || data[0] != 1)
+    {
+        return -1;
+    }
+
+    return data[1] | (data[2] << 8);
+}
+
+/*
+Metadata-only fast path: walks the blocks of a GIF and skips every image's LZW sub-blocks by their
+length bytes. Never decodes anything and never reads past length. Returns false if it's not a GIF.
+*/
+inline bool read_gif_info(const uint8_t* bytes, size_t length, GIFInfo& info)
+{
+    if (length < 13 || std::memcmp(bytes, "GIF", 3) != 0)
+    {
+        return false;
+    }
+
+    info.canvas_width = bytes[6] | (bytes[7] << 8);
+    info.canvas_height = bytes[8] | (bytes[9] << 8);
+    info.frame_count = 0;
+    info.duration = 0;
+    info.loop_count = -1;
+
+    size_t idx = 13;
+
+    if (get_bit(bytes[10], 7))
+    {
+        idx += 3 * (1 << (get_val(bytes[10], 0, 3) + 1)); // global color table
+    }
+
+    auto skip = [&]()
+    {
+        while (idx < length)
+        {
+            size_t nbytes = bytes[idx++];
+
+            if (nbytes == 0)
+            {
+                break;
+            }
+
+            idx += nbytes;
+        }
+    };
+
+    while (idx < length)
+    {
+        uint8_t b = bytes[idx++];
+
+        if (b == 0x2C) // Image descriptor
+        {
+            if (idx + 9 > length)
+            {
+                break;
+            }
+
+            uint8_t packed = bytes[idx + 8];
+            idx += 9;
+
+            if (get_bit(packed, 7))
+            {
+                idx += 3 * (1 << (get_val(packed, 0, 3) + 1)); // local color table
+            }
+
+            idx++; // LZW minimum code size
+            skip();
+            info.frame_count++;
+        }
+        else if (b == 0x21 && idx < length) // Extension introducer
+        {
+            uint8_t label = bytes[idx++];
+
+            if (label == 0xF9 && idx + 5 <= length) // Graphic control extension
+            {
+                info.duration += bytes[idx + 2] | (bytes[idx + 3] << 8);
+            }
+            else if (label == 0xFF && idx + 15 <= length && bytes[idx] == 11) // Application extension
+            {
+                int loop = netscape_loop_count(reinterpret_cast<const char*>(&bytes[idx + 1]), &bytes[idx + 13], std::min<size_t>(bytes[idx + 12], length - idx - 13));
+
+                if (loop >= 0)
+                {
+                    info.loop_count = loop;
+                }
+            }
+
+            skip();
+        }
+        else // Trailer or garbage
+        {
+            break;
+        }
+    }
+
+    return true;
+}
+
+/* Row number in the image for the y-th row of an interlaced data stream */
+inline size_t interlaced_row(size_t y, size_t height)
+{
+    size_t pass1 = (height + 7) / 8; // rows 0, 8, 16, ...
+    size_t pass2 = (height + 3) / 8; // rows 4, 12, 20, ...
+    size_t pass3 = (height + 1) / 4; // rows 2, 6, 10, ...
+
+    if (y < pass1) return y * 8;
+    y -= pass1;
+    if (y < pass2) return y * 8 + 4;
+    y -= pass2;
+    if (y < pass3) return y * 4 + 2;
+    y -= pass3;
+    return y * 2 + 1;
+}
+
+/*
+Decode a LZW code stream (sub-blocks already concatenated) of an image that is width pixels wide.
+row_fn(y, indices) is called for every complete row in stream order, so at most one row of
+color indices is stored at any time. Returns the number of rows decoded.
+*/
+template<typename RowFn>
+size_t lzw_decode(const uint8_t* data, size_t length, size_t lzw_min, size_t width, size_t height, RowFn row_fn)
+{
+    if (lzw_min < 1 || lzw_min > 11 || width == 0)
+    {
+        return 0;
+    }
+
+    uint16_t prefix[0x1000];
+    uint8_t suffix[0x1000];
+    uint16_t str_len[0x1000];
+    uint8_t str[0x1000];
+
+    int clear_code = 1 << lzw_min;
+    int eoi_code = clear_code + 1;
+
+    for (int i = 0; i < clear_code; ++i)
+    {
+        prefix[i] = 0;
+        suffix[i] = i;
+        str_len[i] = 1;
+    }
+
+    int first_code_size = lzw_min + 1;
+    int code_size = first_code_size;
+    int table_index = eoi_code + 1; // counter for adding new entries to the table
+    int prev = -1; // old code
+
+    uint32_t acc = 0; // bit accumulator; codes are packed starting from the least significant bit
+    int nbits = 0;
+    size_t pos = 0;
+
+    std::vector<uint8_t> row(width);
+    size_t x = 0;
+    size_t y = 0;
+
+    while (y < height)
+    {
+        while (nbits < code_size && pos < length)
+        {
+            acc |= uint32_t(data[pos++]) << nbits;
+            nbits += 8;
+        }
+
+        if (nbits < code_size)
+        {
+            break; // ran out of data before EOI
+        }
+
+        int code = acc & ((1 << code_size) - 1);
+        acc >>= code_size;
+        nbits -= code_size;
+
+        if (code == clear_code)
+        {
+            code_size = first_code_size;
+            table_index = eoi_code + 1;
+            prev = -1;
+            continue;
+        }
+        else if (code == eoi_code)
+        {
+            break;
+        }
+
+        int len;
+        uint8_t k;
+
+        if (prev == -1)
+        {
+            if (code >= clear_code)
+            {
+                break; // corrupt stream
+            }
+
+            str[0] = code;
+            len = 1;
+            prev = code;
+        }
+        else
+        {
+            int c;
+
+            if (code < table_index)
+            {
+                c = code;
+                len = str_len[code];
+            }
+            else if (code == table_index)
+            {
+                c = prev;
+                len = str_len[prev] + 1;
+            }
+            else
+            {
+                break; // corrupt stream
+            }
+
+            int p = str_len[c] - 1;
+
+            while (c >= clear_code)
+            {
+                str[p--] = suffix[c];
+                c = prefix[c];
+            }
+
+            str[p] = c;
+            k = c; // first index of the string
+
+            if (code == table_index)
+            {
+                str[len - 1] = k;
+            }
+
+            if (table_index < 0x1000)
+            {
+                prefix[table_index] = prev;
+                suffix[table_index] = k;
+                str_len[table_index] = str_len[prev] + 1;
+                table_index++;
+
+                if (table_index == (1 << code_size) && code_size < 12)
+                {
+                    code_size++; // increase as soon as the index is equal to 2^(code_size)-1
+                }
+            }
+
+            prev = code;
+        }
+
+        for (int i = 0; i < len && y < height; )
+        {
+            size_t n = std::min(size_t(len - i), width - x);
+            std::memcpy(&row[x], &str[i], n);
+            x += n;
+            i += n;
+
+            if (x == width)
+            {
+                row_fn(y, row.data());
+                x = 0;
+                y++;
+            }
+        }
+    }
+
+    return y;
+}
+
+/* Decode all color indices of img into img.index (rows are de-interlaced) */
+inline void decode_image(const GIF& gif, Image& img)
+{
+    std::vector<uint8_t> stream;
+    read_sub_blocks(gif.bytes, img.data_offset, stream);
+
+    img.index.assign(img.width * img.height, 0);
+
+    lzw_decode(stream.data(), stream.size(), img.lzw_min, img.width, img.height, [&](size_t y, const uint8_t* row)
+    {
+        size_t r = img.interlace ? interlaced_row(y, img.height) : y;
+        std::memcpy(&img.index[r * img.width], row, img.width);
+    });
+}
+
+/* Whether the frame's rectangle covers the whole logical screen */
+inline bool covers_canvas(const GIF& gif, const Frame& f)
+{
+    const Image* img = f.image;
+
+    return img->left <= 0 && img->top <= 0 &&
+           img->left + img->width >= gif.canvas_width && img->top + img->height >= gif.canvas_height;
+}
+
+/*
+Fill in the timing and keyframe fields of gif.frames. A frame is a keyframe if it is drawn onto a
+canvas that only holds the background color, or if it covers the whole canvas with opaque pixels
+(and doesn't ask for the canvas under it to be restored afterwards).
+*/
+inline void index_frames(GIF& gif)
+{
+    int time = 0;
+    bool clean = true; // canvas holds nothing but the background before the current frame
+
+    for (auto& f : gif.frames)
+    {
+        bool covers = covers_canvas(gif, f);
+
+        f.start_time = time;
+        f.keyframe = clean || (covers && !f.transparent && f.disposal_method != 3);
+
+        time += f.delay_time;
+
+        if (f.disposal_method == 2)
+        {
+            clean = covers;
+        }
+        else if (f.disposal_method != 3)
+        {
+            clean = false; // method 3 brings back the canvas as it was before this frame
+        }
+    }
+}
+
+/* Whether block is a plain text extension, which takes the graphic control extension before it */
+inline bool is_plain_text(const GIFBlock* block)
+{
+    return block->type == BT_OTHER_EXTENSION && static_cast<const OtherExtension*>(block)->label == 0x01;
+}
+
+/* Read ncolors RGB triplets at idx; false if the file ends before them */
+inline bool read_color_table(const std::vector<uint8_t>& bytes, size_t& idx, size_t ncolors, std::vector<Color>& ct)
+{
+    if (idx + 3 * ncolors > bytes.size())
+    {
+        return false;
+    }
+
+    ct.resize(ncolors);
+
+    for (size_t i = 0; i < ncolors; ++i)
+    {
+        ct[i].r = bytes[idx++];
+        ct[i].g = bytes[idx++];
+        ct[i].b = bytes[idx++];
+    }
+
+    return true;
+}
+
+/* Parse the block structure of gif.bytes; returns false if the file is not a GIF or is cut off inside a block header */
+inline bool parse_gif(GIF& gif)
+{
+    const std::vector<uint8_t>& bytes = gif.bytes;
+
+    /* Process header block - bytes 0 to 5 */
+
+    if (bytes.size() < 13 || bytes[0] != 'G' || bytes[1] != 'I' || bytes[2] != 'F')
+    {
+        return false;
+    }
+
+    // 87a files are read the same way, they just have no extensions
+
+    /* Process logical screen descriptor bytes 6 to 12 */
+
+    gif.canvas_width = bytes[6] | (bytes[7] << 8); // data are stored in little-endian format
+    gif.canvas_height = bytes[8] | (bytes[9] << 8);
+
+    int8_t packed_field = bytes[10];
+
+    gif.gct_flag = get_bit(packed_field, 7); // most significant bit
+    gif.color_resolution = get_val(packed_field, 4, 3);
+    size_t gct_size = get_val(packed_field, 0, 3);
+    gif.bkgd_color_idx = bytes[11];
+
+    size_t idx = 13;
+
+    /* Process global color table (optional) */
+
+    if (gif.gct_flag)
+    {
+        if (!read_color_table(bytes, idx, 1 << (gct_size + 1), gif.gct))
+        {
+            std::cerr << "Truncated global color table" << std::endl;
+            return false;
+        }
+    }
+
+    /* Process graphics control extension, application extension, comment extension, etc. until eof */
+
+    GraphicsControl* gc = nullptr; // applies to the next image only
+    bool done = false;
+
+    /* http://giflib.sourceforge.net/whatsinagif/gif_file_stream.gif */
+    while (!done)
+    {
+        if (idx >= bytes.size())
+        {
+            std::cerr << "Unexpected end of GIF data" << std::endl;
+            break;
+        }
+
+        size_t block_start = idx;
+        size_t nblocks = gif.blocks.size();
+        uint8_t b = bytes[idx++];
+
+        switch (b)
+        {
+        case 0x2C: // Image descriptor
+        {
+            std::unique_ptr<Image> i(new Image);
+
+            if (idx + 9 > bytes.size())
+            {
+                std::cerr << "Truncated image descriptor" << std::endl;
+                return false;
+            }
+
+            i->left = bytes[idx] | (bytes[idx + 1] << 8);
+            i->top = bytes[idx + 2] | (bytes[idx + 3] << 8);
+            i->width = bytes[idx + 4] | (bytes[idx + 5] << 8);
+            i->height = bytes[idx + 6] | (bytes[idx + 7] << 8);
+            idx += 8;
+
+            int8_t packed_field = bytes[idx++];
+
+            i->interlace = get_bit(packed_field, 6);
+
+            bool lct_flag = get_bit(packed_field, 7); // most significant bit
+            size_t lct_size = get_val(packed_field, 0, 3);
+
+            /* Process local color table (optional) */
+
+            i->local_ct = lct_flag;
+
+            if (lct_flag)
+            {
+                if (!read_color_table(bytes, idx, 1 << (lct_size + 1), i->ct))
+                {
+                    std::cerr << "Truncated local color table" << std::endl;
+                    return false;
+                }
+            }
+            else
+            {
+                i->ct = gif.gct; // use global color table instead
+            }
+
+            if (idx >= bytes.size())
+            {
+                std::cerr << "Truncated image descriptor" << std::endl;
+                return false;
+            }
+
+            i->lzw_min = bytes[idx++]; // minimum number of bits to represent a color (or pixel)
+            i->data_offset = idx;
+
+            idx = skip_sub_blocks(bytes, idx); // decoded later
+
+            Frame f;
+            f.image = i.get();
+            f.transparent = gc != nullptr && gc->transparent;
+            f.disposal_method = gc != nullptr ? gc->disposal_method : 0;
+            f.delay_time = gc != nullptr ? gc->delay_time : 0;
+            f.trans_idx = gc != nullptr ? gc->color_index : 0;
+
+            gif.frames.push_back(f);
+            gif.blocks.push_back(std::move(i));
+            gc = nullptr;
+
+            break;
+        }
+        case 0x21: // Extension introducer
+        {
+            if (idx + 1 >= bytes.size())
+            {
+                std::cerr << "Truncated extension" << std::endl;
+                return false;
+            }
+
+            uint8_t label = bytes[idx++];
+
+            switch (label)
+            {
+            case 0xF9: // Graphic control extension (optional)
+            {
+                std::unique_ptr<GraphicsControl> g(new GraphicsControl);
+
+                size_t block_size = bytes[idx++]; // always 4
+
+                if (block_size < 4 || idx + block_size > bytes.size())
+                {
+                    std::cerr << "Bad graphic control extension" << std::endl;
+                    return false;
+                }
+
+                int8_t packed = bytes[idx];
+
+                g->transparent = get_bit(packed, 0);
+                g->user_input = get_bit(packed, 1);
+                g->disposal_method = get_val(packed, 2, 3);
+
+                g->delay_time = bytes[idx + 1] | (bytes[idx + 2] << 8);
+                g->color_index = bytes[idx + 3];
+
+                idx += block_size;
+                idx = skip_sub_blocks(bytes, idx); // skip the terminator
+
+                gc = g.get();
+                gif.blocks.push_back(std::move(g));
+
+                break;
+            }
+            case 0xFF: // Application extension
+            {
+                std::unique_ptr<ApplicationExtension> ae(new ApplicationExtension);
+
+                size_t block_size = bytes[idx++]; // always 11
+
+                if (block_size < 11 || idx + block_size > bytes.size())
+                {
+                    std::cerr << "Bad application extension" << std::endl;
+                    return false;
+                }
+
+                for (int i = 0; i < 8; ++i) ae->appid[i] = bytes[idx + i]; // Application identifier
+                for (int i = 0; i < 3; ++i) ae->authcode[i] = bytes[idx + 8 + i]; // Application auth code
+
+                idx += block_size;
+                idx = read_sub_blocks(bytes, idx, ae->data);
+
+                int loop = netscape_loop_count(ae->appid, ae->data.data(), ae->data.size());
+
+                if (loop >= 0)
+                {
+                    gif.loop_count = loop;
+                }
+
+                gif.blocks.push_back(std::move(ae));
+
+                break;
+            }
+            case 0xFE: // Comment extension
+            {
+                std::unique_ptr<CommentBlock> cb(new CommentBlock);
+
+                while (idx < bytes.size())
+                {
+                    size_t nbytes = bytes[idx++]; // size of a data sub-block
+                    if (nbytes == 0) break;
+
+                    cb->comments.push_back(std::string(bytes.begin() + idx, bytes.begin() + std::min(idx + nbytes, bytes.size())));
+                    idx += nbytes;
+                }
+
+                gif.blocks.push_back(std::move(cb));
+
+                break;
+            }
+            default: // Plain text extension (0x01) or an unknown one, not shown but kept
+            {
+                std::unique_ptr<OtherExtension> oe(new OtherExtension);
+                oe->label = label;
+
+                idx = skip_sub_blocks(bytes, idx); // the plain text header is a sub-block as well
+
+                if (label == 0x01)
+                {
+                    gc = nullptr; // its graphic control extension is the text's, not the next image's
+                }
+
+                gif.blocks.push_back(std::move(oe));
+
+                break;
+            }
+            }
+            break;
+        }
+        case 0x3B: // Trailer
+        {
+            done = true;
+            break;
+        }
+        default:
+        {
+            std::cerr << "WTF: " << HexToString(b) << std::endl;
+            done = true;
+            break;
+        }
+        }
+
+        if (gif.blocks.size() > nblocks)
+        {
+            gif.blocks.back()->offset = block_start;
+            gif.blocks.back()->length = std::min(idx, bytes.size()) - block_start;
+        }
+    }
+
+    index_frames(gif);
+
+    return true;
+}
+
+inline bool load_gif(const char* path, GIF& gif)
+{
+    return read_file(path, gif.bytes) && parse_gif(gif);
+}
+
+/* Append the bytes of a parsed block as they are in the file */
+inline void copy_block(std::vector<uint8_t>& out, const GIF& gif, const GIFBlock* block)
+{
+    out.insert(out.end(), gif.bytes.begin() + block->offset, gif.bytes.begin() + block->offset + block->length);
+}
+
+/*
+Copy the header, logical screen descriptor and the first length - 13 bytes after them (the global
+color table), as version 89a: the output may hold extensions that 87a doesn't have.
+*/
+inline void copy_header(std::vector<uint8_t>& out, const GIF& gif, size_t length)
+{
+    out.insert(out.end(), gif.bytes.begin(), gif.bytes.begin() + length);
+    std::memcpy(&out[out.size() - length], "GIF89a", 6);
+}
+
+#endif
@@ -0,0 +1,2086 @@
+/*
+benchmarks for the decoder and the tools built on it
+
+to compile: g++ gif_bench.cpp -o gif_bench -std=c++14 -O2 -pthread
+usage: gif_bench BENCHMARK [FILE NAME].gif...
+
+e.g. gif_bench roi gifs/[name].gif
+
+benchmarks:
+  roi           full decode vs small crops
+  range         one second clips
+  info          metadata files/s
+  concat        splicing throughput
+  effects       color effects on color tables vs pixels
+  filters       MP/s of each filter
+  reverse       fps playing backwards
+  overlay       blending and stamping speed
+  transparent   compositing onto an opaque vs a transparent background
+  formats       compositing straight into BGRA32 / RGBA32 / RGB565 / RGB24 / GRAY8 vs converting afterwards
+  pyramid       1/2, 1/4, 1/8 downscaling in one pass vs one pass per level
+  hash          perceptual hashes of selected frames vs a full decode
+  motion        motion analysis vs diffing whole canvases, and how many times faster than playback
+  stream        peak memory and speed of streaming 10000 synthetic frames, checked by decoding them
+                (the files are not used)
+  palette       size, time and PSNR of a color table per frame vs the planned global / local tables
+  optimal       size gain and CPU time of optimal clear code placement at 32 / 128 / 512 candidates
+  lossy         size and PSNR of lossy LZW at levels 5 to 80
+  transparency  size, time and bytes saved per frame by choosing between real colors and transparency
+  output        writing a file one sub-block per call vs writev vs the whole buffer at once
+  bitwriter     codes/s of LZWWriter vs a byte-at-a-time writer, and round trips through the decoder
+  input         I420 conversion MP/s plain vs SSE2, and fps of encoding a PAM stream on one thread
+                vs pipelined
+  ratecontrol   settings found, encodes and time for targets of 1/2, 1/4 and 1/10 of the plain size
+  transcode     decode with a sepia effect, resize to 1/2 and encode: fps of each stage, time to
+                the first frame written, total time and sizes
+*/
+
+#include "gif.h"
+#include "gif_canvas.h"
+#include "gif_edit.h"
+#include "gif_filters.h"
+#include "gif_hash.h"
+#include "gif_input.h"
+#include "gif_lossy.h"
+#include "gif_motion.h"
+#include "gif_optimal.h"
+#include "gif_overlay.h"
+#include "gif_palette.h"
+#include "gif_pyramid.h"
+#include "gif_ratecontrol.h"
+#include "gif_stream.h"
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+/* Best wall time of a few runs, in milliseconds */
+template<typename Fn>
+double time_ms(Fn fn, int runs = 3)
+{
+    double best = 1e30;
+
+    for (int r = 0; r < runs; ++r)
+    {
+        auto start = Clock::now();
+        fn();
+        std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+
+    return best;
+}
+
+/* Keep the optimizer from throwing away results */
+static volatile uint32_t sink;
+
+/* Full decode vs decoding only a small crop of every frame */
+void bench_roi(const std::vector<std::string>& files)
+{
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(12) << "full ms"
+              << std::setw(12) << "64x64 ms"
+              << std::setw(12) << "corner ms"
+              << std::setw(10) << "speedup" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif))
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        int w = gif.canvas_width;
+        int h = gif.canvas_height;
+
+        auto run = [&](Rect roi)
+        {
+            return time_ms([&]()
+            {
+                decode_roi(gif, roi, [](size_t, const Canvas& canvas)
+                {
+                    sink = sink + canvas.pixels[0];
+                });
+            });
+        };
+
+        double full = run(Rect{0, 0, w, h});
+        double center = run(Rect{w / 2 - 32, h / 2 - 32, 64, 64});
+        double corner = run(Rect{0, 0, std::min(w, 32), std::min(h, 32)});
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << gif.frames.size()
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << full
+                  << std::setw(12) << center
+                  << std::setw(12) << corner
+                  << std::setw(9) << full / center << "x" << std::endl;
+    }
+}
+
+/* Decoding a one second clip from the middle of the animation vs decoding the whole file */
+void bench_range(const std::vector<std::string>& files)
+{
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(10) << "clip"
+              << std::setw(10) << "replayed"
+              << std::setw(12) << "full ms"
+              << std::setw(12) << "clip ms" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        const Frame& end = gif.frames.back();
+        int duration = (end.start_time + end.delay_time) * 10;
+        int start = duration / 2;
+        size_t first = 0, last = 0;
+
+        if (!find_time_range(gif, start, start + 1000, first, last))
+        {
+            continue;
+        }
+
+        double full = time_ms([&]()
+        {
+            decode_frame_range(gif, 0, gif.frames.size() - 1, [](size_t, const Canvas& canvas)
+            {
+                sink = sink + canvas.pixels[0];
+            });
+        });
+
+        double clip = time_ms([&]()
+        {
+            decode_time_range(gif, start, start + 1000, [](size_t, const Canvas& canvas)
+            {
+                sink = sink + canvas.pixels[0];
+            });
+        });
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << gif.frames.size()
+                  << std::setw(10) << last - first + 1
+                  << std::setw(10) << first - keyframe_before(gif, first)
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << full
+                  << std::setw(12) << clip << std::endl;
+    }
+}
+
+/* Files per second of the metadata-only fast path, from disk and from memory */
+void bench_info(const std::vector<std::string>& files)
+{
+    std::vector<std::vector<uint8_t>> contents(files.size());
+    size_t total_bytes = 0;
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        read_file(files[i].c_str(), contents[i]);
+        total_bytes += contents[i].size();
+    }
+
+    const int rounds = 50;
+    GIFInfo info;
+    std::vector<uint8_t> bytes;
+
+    double disk = time_ms([&]()
+    {
+        for (int r = 0; r < rounds; ++r)
+        {
+            for (auto& file : files)
+            {
+                read_file(file.c_str(), bytes);
+                read_gif_info(bytes.data(), bytes.size(), info);
+                sink = sink + info.frame_count;
+            }
+        }
+    });
+
+    double memory = time_ms([&]()
+    {
+        for (int r = 0; r < rounds; ++r)
+        {
+            for (auto& c : contents)
+            {
+                read_gif_info(c.data(), c.size(), info);
+                sink = sink + info.frame_count;
+            }
+        }
+    });
+
+    double parse = time_ms([&]()
+    {
+        for (auto& c : contents)
+        {
+            GIF gif;
+            gif.bytes = c;
+            parse_gif(gif);
+            sink = sink + gif.frames.size();
+        }
+    });
+
+    double n = double(rounds) * files.size();
+
+    std::cout << std::fixed << std::setprecision(0);
+    std::cout << files.size() << " files, " << total_bytes / 1024 << " KiB" << std::endl;
+    std::cout << "read_gif_info from disk:   " << std::setw(12) << n / disk * 1000 << " files/s" << std::endl;
+    std::cout << "read_gif_info from memory: " << std::setw(12) << n / memory * 1000 << " files/s" << std::endl;
+    std::cout << "parse_gif from memory:     " << std::setw(12) << files.size() / parse * 1000 << " files/s" << std::endl;
+
+    /* tiny three frame animation, the common case for icons and emoji */
+    const uint8_t frame[] = {
+        0x21, 0xF9, 0x04, 0x04, 0x0A, 0x00, 0x00, 0x00, // graphic control, 1/10 s
+        0x2C, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x02, 0x00, 0x00, // 2x2 image
+        0x02, 0x02, 0x44, 0x01, 0x00 // LZW data
+    };
+    const uint8_t netscape[] = {
+        0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00
+    };
+
+    std::vector<uint8_t> small = {'G', 'I', 'F', '8', '9', 'a', 0x02, 0x00, 0x02, 0x00, 0x80, 0x00, 0x00,
+                                  0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF};
+    small.insert(small.end(), netscape, netscape + sizeof(netscape));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        small.insert(small.end(), frame, frame + sizeof(frame));
+    }
+
+    small.push_back(0x3B);
+
+    const int iterations = 1000000;
+
+    double tiny = time_ms([&]()
+    {
+        for (int i = 0; i < iterations; ++i)
+        {
+            read_gif_info(small.data(), small.size(), info);
+            sink = sink + info.duration;
+        }
+    });
+
+    std::cout << "read_gif_info " << small.size() << " byte file: " << std::setw(12) << iterations / tiny * 1000 << " files/s" << std::endl;
+}
+
+/* Splicing all files into one animation vs copying their bytes */
+void bench_concat(const std::vector<std::string>& files)
+{
+    std::vector<GIF> gifs(files.size());
+    std::vector<const GIF*> inputs;
+    size_t total_bytes = 0;
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!load_gif(files[i].c_str(), gifs[i]))
+        {
+            std::cerr << "Couldn't read GIF file: " << files[i] << std::endl;
+            return;
+        }
+
+        inputs.push_back(&gifs[i]);
+        total_bytes += gifs[i].bytes.size();
+    }
+
+    std::vector<uint8_t> out;
+    ConcatStats stats;
+
+    double concat = time_ms([&]()
+    {
+        out.clear();
+        concat_gifs(inputs, out, &stats);
+    });
+
+    std::vector<uint8_t> copy;
+
+    double memcpy = time_ms([&]()
+    {
+        copy.clear();
+
+        for (auto& gif : gifs)
+        {
+            copy.insert(copy.end(), gif.bytes.begin(), gif.bytes.end());
+        }
+    });
+
+    double mb = total_bytes / 1048576.0;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << files.size() << " files, " << mb << " MiB in, " << out.size() / 1048576.0 << " MiB out" << std::endl;
+    std::cout << stats.frames_copied << " frames copied, " << stats.tables_converted << " given a local color table, "
+              << stats.frames_inserted << " inserted" << std::endl;
+    std::cout << "concat_gifs: " << std::setw(10) << mb / concat * 1000 << " MiB/s" << std::endl;
+    std::cout << "plain copy:  " << std::setw(10) << mb / memcpy * 1000 << " MiB/s" << std::endl;
+}
+
+/* Color effects on the color tables vs the same effects on every composited pixel */
+void bench_effects(const std::vector<std::string>& files)
+{
+    std::vector<PaletteEffect> effects(2);
+    parse_effect("sepia", effects[0]);
+    parse_effect("hue:0-360", effects[1]);
+
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(12) << "plain ms"
+              << std::setw(12) << "palette ms"
+              << std::setw(12) << "pixel ms" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif))
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        for (auto& f : gif.frames)
+        {
+            decode_image(gif, *f.image); // leave LZW out of the comparison
+        }
+
+        auto run = [&](bool palette, bool pixel)
+        {
+            return time_ms([&]()
+            {
+                Canvas canvas(gif);
+                std::vector<uint32_t> out;
+
+                if (palette)
+                {
+                    canvas.effects = effects;
+                }
+
+                for (auto& f : gif.frames)
+                {
+                    canvas.draw(f);
+
+                    if (pixel)
+                    {
+                        float t = effect_progress(gif, f);
+                        out.resize(canvas.pixels.size());
+
+                        for (size_t i = 0; i < canvas.pixels.size(); ++i)
+                        {
+                            uint32_t p = canvas.pixels[i];
+                            Color c{uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p)};
+
+                            for (auto& fx : effects)
+                            {
+                                c = apply_effect(fx, fx.from + (fx.to - fx.from) * t, c);
+                            }
+
+                            out[i] = color_rgba(c.r, c.g, c.b, 255);
+                        }
+                    }
+
+                    sink = sink + canvas.pixels[0];
+                }
+            });
+        };
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << run(false, false)
+                  << std::setw(12) << run(true, false)
+                  << std::setw(12) << run(false, true) << std::endl;
+    }
+}
+
+/* Megapixels per second of each filter on a 1920x1080 frame, on one thread and on all of them */
+void bench_filters(const std::vector<std::string>& files)
+{
+    const size_t width = 1920;
+    const size_t height = 1080;
+    std::vector<uint32_t> frame(width * height);
+
+    if (!files.empty() && files[0] != "-")
+    {
+        // tile the first frame of a real GIF over the test frame
+        GIF gif;
+
+        if (load_gif(files[0].c_str(), gif) && !gif.frames.empty())
+        {
+            Canvas canvas(gif);
+            canvas.draw(gif.frames[0]);
+
+            for (size_t y = 0; y < height; ++y)
+            {
+                for (size_t x = 0; x < width; ++x)
+                {
+                    frame[y * width + x] = canvas.pixels[(y % canvas.height()) * canvas.width() + x % canvas.width()];
+                }
+            }
+        }
+    }
+
+    const char* specs[] = {"blur:1", "blur:8", "sharpen:0.7", "pixelate:8", "vignette:0.8", "chromakey:00ff00:60"};
+    int all = std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << std::left << std::setw(24) << "filter" << std::right
+              << std::setw(14) << "1 thread"
+              << std::setw(10) << all << " threads" << std::endl;
+
+    for (const char* spec : specs)
+    {
+        FilterChain chain;
+        chain.filters.resize(1);
+        parse_filter(spec, chain.filters[0]);
+
+        std::vector<uint32_t> pixels;
+        double mp = width * height / 1e6;
+
+        auto run = [&](int threads)
+        {
+            chain.threads = threads;
+
+            return time_ms([&]()
+            {
+                pixels = frame;
+                chain.apply(pixels.data(), width, height);
+            }, 5);
+        };
+
+        std::cout << std::left << std::setw(24) << spec << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << mp / run(1) * 1000 << " MP/s"
+                  << std::setw(10) << mp / run(all) * 1000 << " MP/s" << std::endl;
+    }
+}
+
+/* Frames per second playing forward, backward with FrameCache and backward replaying from the keyframe every frame */
+void bench_reverse(const std::vector<std::string>& files)
+{
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(10) << "file fps"
+              << std::setw(12) << "fwd fps"
+              << std::setw(12) << "rev fps"
+              << std::setw(12) << "naive fps"
+              << std::setw(10) << "canvases" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        for (auto& f : gif.frames)
+        {
+            decode_image(gif, *f.image); // like the viewer, only compositing is left
+        }
+
+        size_t n = gif.frames.size();
+        const Frame& end = gif.frames.back();
+        int duration = end.start_time + end.delay_time;
+        Canvas canvas(gif);
+        size_t cached = 0;
+
+        double forward = time_ms([&]()
+        {
+            FrameCache cache(canvas);
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                sink = sink + cache.at(i)[0];
+            }
+        });
+
+        double reverse = time_ms([&]()
+        {
+            FrameCache cache(canvas);
+
+            for (size_t i = n; i-- > 0;)
+            {
+                sink = sink + cache.at(i)[0];
+            }
+
+            cached = cache.cached();
+        });
+
+        double naive = time_ms([&]()
+        {
+            for (size_t i = n; i-- > 0;)
+            {
+                canvas.reset();
+
+                for (size_t k = keyframe_before(gif, i); k <= i; ++k)
+                {
+                    canvas.draw(gif.frames[k]);
+                }
+
+                sink = sink + canvas.pixels[0];
+            }
+        }, 1);
+
+        std::cout << std::left << std::setw(40) << file << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(8) << n
+                  << std::setw(10) << (duration > 0 ? n * 100.0 / duration : 0)
+                  << std::setw(12) << n / forward * 1000
+                  << std::setw(12) << n / reverse * 1000
+                  << std::setw(12) << n / naive * 1000
+                  << std::setw(10) << cached << std::endl;
+    }
+}
+
+/* Blending a canvas sized overlay, and stamping a 64x64 one onto every frame of the file */
+void bench_overlay(const std::vector<std::string>& files)
+{
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(10) << "stamped"
+              << std::setw(12) << "blend MP/s"
+              << std::setw(12) << "decode ms"
+              << std::setw(12) << "export ms" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        int w = gif.canvas_width;
+        int h = gif.canvas_height;
+        std::vector<uint32_t> logo(size_t(w) * h);
+
+        for (int y = 0; y < h; ++y)
+        {
+            for (int x = 0; x < w; ++x)
+            {
+                logo[size_t(y) * w + x] = color_rgba(x * 255 / w, y * 255 / h, 128, (x + y) & 0xFF);
+            }
+        }
+
+        Overlay full;
+        full.set(logo.data(), w, h, 0, 0);
+
+        Canvas canvas(gif);
+        canvas.draw(gif.frames[0]);
+
+        double blend = time_ms([&]()
+        {
+            for (int k = 0; k < 20; ++k)
+            {
+                full.blend(canvas.pixels.data(), canvas.roi);
+            }
+        });
+
+        Overlay small;
+        small.set(logo.data(), std::min(w, 64), std::min(h, 64), w / 2 - 32, h / 2 - 32, 0.5f);
+
+        double decode = time_ms([&]()
+        {
+            decode_roi(gif, canvas.roi, [](size_t, const Canvas& canvas)
+            {
+                sink = sink + canvas.pixels[0];
+            });
+        }, 1);
+
+        OverlayStats stats;
+        std::vector<uint8_t> out;
+
+        double stamp = time_ms([&]()
+        {
+            out.clear();
+            overlay_gif(gif, small, out, &stats);
+        }, 1);
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << gif.frames.size()
+                  << std::setw(10) << stats.frames_stamped
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(12) << 20.0 * w * h / blend / 1000
+                  << std::setw(12) << decode
+                  << std::setw(12) << stamp << std::endl;
+    }
+}
+
+/* Compositing (frames decoded beforehand) onto an opaque vs a transparent background */
+void bench_transparent(const std::vector<std::string>& files)
+{
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(12) << "opaque ms"
+              << std::setw(12) << "clear ms" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif))
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        for (auto& f : gif.frames)
+        {
+            decode_image(gif, *f.image);
+        }
+
+        Canvas opaque(gif), clear(gif, true);
+
+        auto run = [&](Canvas& canvas)
+        {
+            return time_ms([&]()
+            {
+                canvas.reset();
+
+                for (auto& f : gif.frames)
+                {
+                    canvas.draw(f);
+                    sink = sink + canvas.pixels[0];
+                }
+            }, 1);
+        };
+
+        // the modes take turns, so that frequency scaling and the cache affect both alike
+        double opaque_ms = 1e30, clear_ms = 1e30;
+
+        for (int k = 0; k < 50; ++k)
+        {
+            opaque_ms = std::min(opaque_ms, run(opaque));
+            clear_ms = std::min(clear_ms, run(clear));
+        }
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << gif.frames.size()
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << opaque_ms
+                  << std::setw(12) << clear_ms << std::endl;
+    }
+}
+
+/* Compositing straight into Format vs compositing BGRA and converting every frame afterwards */
+template<typename Format>
+void bench_format(const GIF& gif, const char* name)
+{
+    typedef typename Format::Pixel Pixel;
+
+    BasicCanvas<Format> direct(gif);
+    Canvas bgra(gif);
+    std::vector<Pixel> converted(bgra.pixels.size());
+
+    double ms = time_ms([&]()
+    {
+        direct.reset();
+
+        for (auto& f : gif.frames)
+        {
+            direct.draw(f);
+            sink = sink + reinterpret_cast<const uint8_t*>(direct.pixels.data())[0];
+        }
+    }, 5);
+
+    double convert_ms = time_ms([&]()
+    {
+        bgra.reset();
+
+        for (auto& f : gif.frames)
+        {
+            bgra.draw(f);
+
+            for (size_t i = 0; i < converted.size(); ++i)
+            {
+                uint32_t p = bgra.pixels[i];
+                converted[i] = Format::pack(p >> 16, p >> 8, p, p >> 24);
+            }
+
+            sink = sink + reinterpret_cast<const uint8_t*>(converted.data())[0];
+        }
+    }, 5);
+
+    std::cout << std::setw(10) << name << std::fixed << std::setprecision(2)
+              << std::setw(12) << ms
+              << std::setw(14) << convert_ms << std::endl;
+}
+
+void bench_formats(const std::vector<std::string>& files)
+{
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif))
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        for (auto& f : gif.frames)
+        {
+            decode_image(gif, *f.image);
+        }
+
+        std::cout << file << " (" << gif.frames.size() << " frames)" << std::endl;
+        std::cout << std::setw(10) << "format" << std::setw(12) << "direct ms" << std::setw(14) << "convert ms" << std::endl;
+
+        bench_format<BGRA32>(gif, "BGRA32");
+        bench_format<RGBA32>(gif, "RGBA32");
+        bench_format<RGB565>(gif, "RGB565");
+        bench_format<RGB24>(gif, "RGB24");
+        bench_format<GRAY8>(gif, "GRAY8");
+    }
+}
+
+/* Building all pyramid levels in one pass vs one pass per level */
+void bench_pyramid(const std::vector<std::string>& files)
+{
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(14) << "fused MP/s"
+              << std::setw(14) << "levels MP/s" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        std::vector<std::vector<uint32_t>> frames;
+
+        decode_roi(gif, Rect{0, 0, int(gif.canvas_width), int(gif.canvas_height)}, [&](size_t, const Canvas& canvas)
+        {
+            frames.push_back(canvas.pixels);
+        });
+
+        size_t w = gif.canvas_width;
+        size_t h = gif.canvas_height;
+        double mp = double(w) * h * frames.size() / 1e6;
+        Pyramid pyramid;
+
+        double fused = time_ms([&]()
+        {
+            for (auto& pixels : frames)
+            {
+                pyramid.build(pixels.data(), w, h);
+                sink = sink + pyramid.pixels(3).size();
+            }
+        }, 5);
+
+        std::vector<uint32_t> level[3];
+
+        double separate = time_ms([&]()
+        {
+            for (auto& pixels : frames)
+            {
+                const uint32_t* src = pixels.data();
+
+                for (int n = 0; n < 3; ++n)
+                {
+                    size_t lw = w >> (n + 1);
+                    size_t lh = h >> (n + 1);
+
+                    level[n].resize(lw * lh);
+
+                    for (size_t y = 0; y < lh; ++y)
+                    {
+                        downsample_row(src + 2 * y * (2 * lw + ((w >> n) & 1)), src + (2 * y + 1) * (2 * lw + ((w >> n) & 1)), &level[n][y * lw], lw);
+                    }
+
+                    src = level[n].data();
+                }
+
+                sink = sink + level[2].size();
+            }
+        }, 5);
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << frames.size()
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(14) << mp / fused * 1000
+                  << std::setw(14) << mp / separate * 1000 << std::endl;
+    }
+}
+
+/* Hashing the selected frames from a downscaled copy vs decoding everything and hashing at full size */
+void bench_hash(const std::vector<std::string>& files)
+{
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(10) << "hashed"
+              << std::setw(12) << "fused ms"
+              << std::setw(12) << "full ms" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        std::vector<size_t> selection = hash_selection(gif);
+        std::vector<FrameHash> hashes;
+
+        double fused = time_ms([&]()
+        {
+            hash_frames(gif, selection, hashes);
+            sink = sink + uint32_t(hashes[0].phash);
+        });
+
+        double full = time_ms([&]()
+        {
+            size_t k = 0;
+
+            decode_roi(gif, Rect{0, 0, int(gif.canvas_width), int(gif.canvas_height)}, [&](size_t i, const Canvas& canvas)
+            {
+                if (k < selection.size() && selection[k] == i)
+                {
+                    sink = sink + uint32_t(phash(canvas.pixels.data(), canvas.width(), canvas.height()) ^ dhash(canvas.pixels.data(), canvas.width(), canvas.height()));
+                    k++;
+                }
+            });
+        });
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << gif.frames.size()
+                  << std::setw(10) << selection.size()
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << fused
+                  << std::setw(12) << full << std::endl;
+    }
+}
+
+void bench_motion(const std::vector<std::string>& files)
+{
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(8) << "cuts"
+              << std::setw(12) << "motion ms"
+              << std::setw(12) << "full ms"
+              << std::setw(12) << "x realtime" << std::endl;
+
+    std::vector<GIF> gifs;
+
+    for (auto& file : files)
+    {
+        gifs.emplace_back();
+
+        if (!load_gif(file.c_str(), gifs.back()) || gifs.back().frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            gifs.pop_back();
+            continue;
+        }
+
+        const GIF& gif = gifs.back();
+        std::vector<FrameMotion> motion;
+        size_t cuts = 0;
+
+        double analyzed = time_ms([&]()
+        {
+            analyze_motion(gif, motion);
+            sink = sink + motion.size();
+        });
+
+        for (auto& m : motion)
+        {
+            cuts += m.scene_cut;
+        }
+
+        // the same numbers from diffing the whole canvas after every frame
+        double full = time_ms([&]()
+        {
+            Canvas canvas(gif);
+            std::vector<uint32_t> prev = canvas.pixels;
+
+            for (auto& f : gif.frames)
+            {
+                size_t changed = 0;
+                uint64_t sad = 0;
+
+                canvas.draw(f);
+                diff_row(prev.data(), canvas.pixels.data(), prev.size(), changed, sad);
+                prev = canvas.pixels;
+                sink = sink + changed;
+            }
+        });
+
+        const Frame& end = gif.frames.back();
+        int duration = (end.start_time + end.delay_time) * 10;
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << gif.frames.size()
+                  << std::setw(8) << cuts
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << analyzed
+                  << std::setw(12) << full
+                  << std::setw(12) << std::setprecision(0) << (analyzed > 0 ? duration / analyzed : 0) << std::endl;
+    }
+
+    // all files at once, on one thread and on one thread per core
+    std::vector<unsigned> thread_counts{1};
+
+    if (std::thread::hardware_concurrency() > 1)
+    {
+        thread_counts.push_back(std::thread::hardware_concurrency());
+    }
+
+    for (unsigned thread_count : thread_counts)
+    {
+        double ms = time_ms([&]()
+        {
+            std::atomic<size_t> next(0);
+            std::vector<std::thread> workers;
+
+            for (unsigned t = 0; t < thread_count; ++t)
+            {
+                workers.emplace_back([&]()
+                {
+                    std::vector<FrameMotion> motion;
+
+                    for (size_t i = next++; i < gifs.size(); i = next++)
+                    {
+                        analyze_motion(gifs[i], motion);
+                    }
+                });
+            }
+
+            for (auto& w : workers)
+            {
+                w.join();
+            }
+        });
+
+        std::cout << "all files, " << thread_count << " thread(s): " << std::setprecision(2) << ms << " ms" << std::endl;
+    }
+}
+
+/* Peak resident set size of the process in kilobytes */
+long peak_rss_kb()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+/*
+Frame i of a synthetic screen recording: a slowly scrolling background with a square moving over
+it. Every tenth frame repeats the one before it.
+*/
+void synthetic_frame(size_t i, size_t width, size_t height, std::vector<uint32_t>& pixels)
+{
+    size_t t = i % 10 == 9 ? i - 1 : i;
+    size_t sx = t * 3 % (width - 32);
+    size_t sy = t * 2 % (height - 32);
+
+    pixels.resize(width * height);
+
+    for (size_t y = 0; y < height; ++y)
+    {
+        for (size_t x = 0; x < width; ++x)
+        {
+            uint8_t v = ((x / 16 + y / 16 + t / 100) % 64) * 4;
+            bool square = x >= sx && x < sx + 32 && y >= sy && y < sy + 32;
+
+            pixels[y * width + x] = square ? color_rgba(255, t % 256, 0, 255) : color_rgba(v, v, v, 255);
+        }
+    }
+}
+
+/* Streaming synthetic frames to a file: time and peak memory (the files are not used) */
+void bench_stream(const std::vector<std::string>&)
+{
+    const size_t width = 320, height = 240, nframes = 10000;
+    const char* path = "gif_bench_stream.gif";
+
+    std::vector<uint32_t> pixels;
+    long rss_before = peak_rss_kb();
+    StreamStats stats;
+
+    auto start = Clock::now();
+
+    {
+        std::ofstream file(path, std::ios::binary);
+        StreamEncoder encoder(file, width, height);
+
+        for (size_t i = 0; i < nframes; ++i)
+        {
+            synthetic_frame(i, width, height, pixels);
+            encoder.push(pixels.data(), 4);
+        }
+
+        encoder.finish();
+        stats = encoder.stats;
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+    long rss_after = peak_rss_kb();
+
+    std::cout << nframes << " frames of " << width << "x" << height << " pushed, "
+              << stats.frames_written << " written, " << stats.bytes_written / 1024 << " KB, "
+              << std::fixed << std::setprecision(0) << nframes * 1000 / elapsed.count() << " frames/s" << std::endl;
+    std::cout << "peak RSS " << rss_before << " KB before, " << rss_after << " KB after"
+              << " (all frames held would be " << nframes * width * height * 4 / 1024 << " KB)" << std::endl;
+
+    // decode the result and compare it with what was pushed (merged frames show the first one)
+    GIF gif;
+    size_t mismatches = 0;
+
+    if (load_gif(path, gif))
+    {
+        Canvas canvas(gif);
+        size_t i = 0;
+
+        for (auto& f : gif.frames)
+        {
+            canvas.draw(f);
+            synthetic_frame(i, width, height, pixels);
+            mismatches += canvas.pixels != pixels;
+            i += f.delay_time / 4;
+        }
+    }
+
+    std::cout << gif.frames.size() << " frames decoded, " << mismatches << " differ from the input" << std::endl;
+    std::remove(path);
+}
+
+/* Composite every frame of gif into its own buffer */
+void decode_frames(const GIF& gif, std::vector<std::vector<uint32_t>>& frames)
+{
+    Canvas canvas(gif);
+    frames.clear();
+
+    for (auto& f : gif.frames)
+    {
+        canvas.draw(f);
+        frames.push_back(canvas.pixels);
+    }
+}
+
+/*
+PSNR (dB) of the frames encoded in bytes against frames. With merged, identical frames in a row
+are expected to be one frame, as StreamEncoder writes them. Returns 0 if bytes isn't a GIF.
+*/
+double stream_psnr(const std::vector<std::vector<uint32_t>>& frames, const std::string& bytes, bool merged = true)
+{
+    GIF gif;
+    gif.bytes.assign(bytes.begin(), bytes.end());
+
+    if (!parse_gif(gif))
+    {
+        return 0;
+    }
+
+    Canvas canvas(gif);
+    double sum = 0;
+    size_t n = 0, k = 0;
+
+    for (auto& f : gif.frames)
+    {
+        canvas.draw(f);
+
+        for (size_t j = 0; k < frames.size() && j < canvas.pixels.size(); ++j)
+        {
+            for (int shift = 0; shift < 24; shift += 8)
+            {
+                int d = int((canvas.pixels[j] >> shift) & 0xFF) - int((frames[k][j] >> shift) & 0xFF);
+                sum += d * d;
+            }
+        }
+
+        n += canvas.pixels.size() * 3;
+
+        for (k++; merged && k < frames.size() && frames[k] == frames[k - 1]; ++k)
+        {
+        }
+    }
+
+    return sum == 0 ? 99 : 10 * std::log10(255.0 * 255.0 * n / sum);
+}
+
+void bench_palette(const std::vector<std::string>& files)
+{
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(8) << "local"
+              << std::setw(10) << "plan ms"
+              << std::setw(12) << "LCT KB"
+              << std::setw(10) << "LCT ms"
+              << std::setw(10) << "LCT dB"
+              << std::setw(12) << "plan KB"
+              << std::setw(10) << "plan ms"
+              << std::setw(10) << "plan dB" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+        std::vector<std::vector<uint32_t>> frames;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        decode_frames(gif, frames);
+
+        std::vector<const uint32_t*> pointers;
+        PalettePlan plan;
+
+        for (auto& f : frames)
+        {
+            pointers.push_back(f.data());
+        }
+
+        double planned = time_ms([&]()
+        {
+            plan_palette(pointers, frames[0].size(), plan);
+        });
+
+        std::string local_bytes, plan_bytes;
+
+        // every frame with its own table
+        double local_ms = time_ms([&]()
+        {
+            std::ostringstream out;
+            StreamEncoder encoder(out, gif.canvas_width, gif.canvas_height);
+
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                encoder.push(frames[i].data(), gif.frames[i].delay_time);
+            }
+
+            encoder.finish();
+            local_bytes = out.str();
+        }, 1);
+
+        // the global table where it's good enough
+        double plan_ms = time_ms([&]()
+        {
+            std::ostringstream out;
+            StreamEncoder encoder(out, gif.canvas_width, gif.canvas_height, 0, plan.global);
+
+            for (size_t i = 0; i < frames.size(); ++i)
+            {
+                encoder.push(frames[i].data(), gif.frames[i].delay_time, plan.local[i]);
+            }
+
+            encoder.finish();
+            plan_bytes = out.str();
+        }, 1);
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << frames.size()
+                  << std::setw(8) << std::count(plan.local.begin(), plan.local.end(), 1)
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(10) << planned
+                  << std::setw(12) << local_bytes.size() / 1024.0
+                  << std::setw(10) << local_ms
+                  << std::setw(10) << stream_psnr(frames, local_bytes)
+                  << std::setw(12) << plan_bytes.size() / 1024.0
+                  << std::setw(10) << plan_ms + planned
+                  << std::setw(10) << stream_psnr(frames, plan_bytes) << std::endl;
+    }
+}
+
+void bench_optimal(const std::vector<std::string>& files)
+{
+    const size_t candidates[] = {32, 128, 512};
+
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(12) << "plain KB"
+              << std::setw(10) << "ms";
+
+    for (size_t c : candidates)
+    {
+        std::cout << std::setw(8) << c << " %" << std::setw(10) << "ms";
+    }
+
+    std::cout << std::setw(12) << "threads ms" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        std::vector<std::vector<uint8_t>> indices;
+
+        for (auto& f : gif.frames)
+        {
+            decode_image(gif, *f.image);
+            indices.push_back(f.image->index);
+        }
+
+        size_t plain_bytes = 0;
+
+        double plain_ms = time_ms([&]()
+        {
+            plain_bytes = 0;
+
+            for (size_t i = 0; i < indices.size(); ++i)
+            {
+                std::vector<uint8_t> out;
+                lzw_encode(indices[i].data(), indices[i].size(), gif.frames[i].image->lzw_min, out);
+                plain_bytes += out.size();
+            }
+        }, 1);
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << plain_bytes / 1024.0
+                  << std::setw(10) << plain_ms;
+
+        // one thread, so the time is the CPU time it costs
+        for (size_t c : candidates)
+        {
+            size_t bytes = 0;
+
+            double ms = time_ms([&]()
+            {
+                bytes = 0;
+
+                for (size_t i = 0; i < indices.size(); ++i)
+                {
+                    std::vector<uint8_t> out;
+                    lzw_encode_optimal(indices[i].data(), indices[i].size(), gif.frames[i].image->lzw_min, out, 1, c);
+                    bytes += out.size();
+                }
+            }, 1);
+
+            std::cout << std::setw(10) << 100.0 * (double(plain_bytes) - bytes) / plain_bytes << std::setw(10) << ms;
+        }
+
+        double threaded = time_ms([&]()
+        {
+            std::vector<uint8_t> out;
+            optimize_gif(gif, out);
+            sink = sink + out.size();
+        }, 1);
+
+        std::cout << std::setw(12) << threaded << std::endl;
+    }
+}
+
+void bench_lossy(const std::vector<std::string>& files)
+{
+    const int levels[] = {5, 10, 20, 40, 80};
+
+    std::cout << std::left << std::setw(40) << "file" << std::right << std::setw(12) << "KB";
+
+    for (int l : levels)
+    {
+        std::cout << std::setw(8) << "lossy " << std::setw(2) << l << std::setw(8) << "dB";
+    }
+
+    std::cout << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+        std::vector<std::vector<uint32_t>> frames;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        decode_frames(gif, frames);
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << gif.bytes.size() / 1024.0;
+
+        for (int l : levels)
+        {
+            std::vector<uint8_t> out;
+            lossy_gif(gif, l, out);
+
+            // size in percent of the original
+            std::cout << std::setw(10) << 100.0 * out.size() / gif.bytes.size()
+                      << std::setw(8) << stream_psnr(frames, std::string(out.begin(), out.end()), false);
+        }
+
+        std::cout << std::endl;
+    }
+}
+
+void bench_transparency(const std::vector<std::string>& files)
+{
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(12) << "trans KB"
+              << std::setw(10) << "ms"
+              << std::setw(12) << "keep KB"
+              << std::setw(10) << "ms"
+              << std::setw(8) << "%"
+              << std::setw(12) << "B/frame"
+              << std::setw(12) << "max B" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+        std::vector<std::vector<uint32_t>> frames;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        decode_frames(gif, frames);
+
+        std::vector<const uint32_t*> pointers;
+        PalettePlan plan;
+
+        for (auto& f : frames)
+        {
+            pointers.push_back(f.data());
+        }
+
+        plan_palette(pointers, frames[0].size(), plan);
+
+        std::string bytes[2];
+        std::vector<size_t> saved; // per frame written
+        double ms[2];
+
+        for (int keep = 0; keep < 2; ++keep)
+        {
+            ms[keep] = time_ms([&]()
+            {
+                std::ostringstream out;
+                StreamEncoder encoder(out, gif.canvas_width, gif.canvas_height, 0, plan.global);
+                size_t written = 0, before = 0;
+
+                encoder.keep_colors = keep;
+                saved.clear();
+
+                for (size_t i = 0; i < frames.size(); ++i)
+                {
+                    encoder.push(frames[i].data(), gif.frames[i].delay_time, plan.local[i]);
+
+                    if (encoder.stats.frames_written > written)
+                    {
+                        written = encoder.stats.frames_written;
+                        saved.push_back(encoder.stats.transparency_saved - before);
+                        before = encoder.stats.transparency_saved;
+                    }
+                }
+
+                encoder.finish();
+                saved.push_back(encoder.stats.transparency_saved - before);
+                bytes[keep] = out.str();
+            }, 1);
+        }
+
+        size_t total = 0, most = 0;
+
+        for (size_t b : saved)
+        {
+            total += b;
+            most = std::max(most, b);
+        }
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << frames.size()
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << bytes[0].size() / 1024.0
+                  << std::setw(10) << ms[0]
+                  << std::setw(12) << bytes[1].size() / 1024.0
+                  << std::setw(10) << ms[1]
+                  << std::setw(8) << 100.0 * (1 - double(bytes[1].size()) / bytes[0].size())
+                  << std::setw(12) << double(total) / saved.size()
+                  << std::setw(12) << most << std::endl;
+
+        if (stream_psnr(frames, bytes[1]) < stream_psnr(frames, bytes[0]))
+        {
+            std::cerr << file << ": keeping colors made it look worse" << std::endl;
+        }
+    }
+}
+
+/* Write all of bytes to fd, one system call unless it's interrupted */
+bool write_all(int fd, const uint8_t* bytes, size_t n, size_t& calls)
+{
+    while (n > 0)
+    {
+        ssize_t written = ::write(fd, bytes, n);
+        calls++;
+
+        if (written <= 0)
+        {
+            return false;
+        }
+
+        bytes += written;
+        n -= written;
+    }
+
+    return true;
+}
+
+void bench_output(const std::vector<std::string>& files)
+{
+    const char* path = "gif_bench_output.gif";
+
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(12) << "KB"
+              << std::setw(12) << "encode ms"
+              << std::setw(12) << "blocks ms"
+              << std::setw(10) << "calls"
+              << std::setw(12) << "writev ms"
+              << std::setw(10) << "calls"
+              << std::setw(12) << "arena ms"
+              << std::setw(10) << "calls" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        for (auto& f : gif.frames)
+        {
+            decode_image(gif, *f.image);
+        }
+
+        // every frame into one arena, sub-blocks framed in place; where each frame's image data starts
+        std::vector<uint8_t> arena;
+        std::vector<size_t> frame_start, data_start;
+
+        double encode = time_ms([&]()
+        {
+            arena.clear();
+            frame_start.clear();
+            data_start.clear();
+
+            write_header(arena, gif.canvas_width, gif.canvas_height, gif.gct);
+
+            for (auto& f : gif.frames)
+            {
+                const Image* img = f.image;
+
+                frame_start.push_back(arena.size());
+                write_image_descriptor(arena, img->left, img->top, img->width, img->height, img->ct);
+                data_start.push_back(arena.size());
+                lzw_encode(img->index.data(), img->index.size(), img->lzw_min, arena);
+            }
+
+            arena.push_back(0x3B);
+        });
+
+        frame_start.push_back(arena.size() - 1);
+
+        size_t calls[3] = {0, 0, 0};
+        double ms[3];
+
+        // naive: header and descriptors in one write each, then one write per sub-block
+        ms[0] = time_ms([&]()
+        {
+            int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            calls[0] = 0;
+            write_all(fd, arena.data(), frame_start[0], calls[0]);
+
+            for (size_t i = 0; i + 1 < frame_start.size(); ++i)
+            {
+                size_t at = data_start[i] + 1;
+
+                write_all(fd, &arena[frame_start[i]], at - frame_start[i], calls[0]);
+
+                while (at < frame_start[i + 1])
+                {
+                    write_all(fd, &arena[at], arena[at] + 1, calls[0]);
+                    at += arena[at] + 1;
+                }
+            }
+
+            write_all(fd, &arena.back(), 1, calls[0]);
+            ::close(fd);
+        });
+
+        // writev: one iovec per frame as if each was in its own buffer, IOV_MAX at a time
+        ms[1] = time_ms([&]()
+        {
+            std::vector<iovec> iov;
+            int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+            iov.push_back(iovec{&arena[0], frame_start[0]});
+
+            for (size_t i = 0; i + 1 < frame_start.size(); ++i)
+            {
+                iov.push_back(iovec{&arena[frame_start[i]], frame_start[i + 1] - frame_start[i]});
+            }
+
+            iov.push_back(iovec{&arena.back(), 1});
+            calls[1] = 0;
+
+            for (size_t i = 0; i < iov.size(); i += IOV_MAX)
+            {
+                ::writev(fd, &iov[i], std::min<size_t>(IOV_MAX, iov.size() - i));
+                calls[1]++;
+            }
+
+            ::close(fd);
+        });
+
+        // the arena in one go
+        ms[2] = time_ms([&]()
+        {
+            int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            calls[2] = 0;
+            write_all(fd, arena.data(), arena.size(), calls[2]);
+            ::close(fd);
+        });
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << arena.size() / 1024.0
+                  << std::setw(12) << encode;
+
+        for (int m = 0; m < 3; ++m)
+        {
+            std::cout << std::setw(12) << ms[m] << std::setw(10) << calls[m];
+        }
+
+        std::cout << std::endl;
+    }
+
+    std::remove(path);
+}
+
+/*
+LZW code writer as it used to be, to check LZWWriter against: a 32-bit accumulator emptied one
+byte at a time into a buffer that is split into sub-blocks at the end. A code equal to the
+clear code resets the code size, every other one adds a table entry.
+*/
+void reference_lzw_writer(const std::vector<uint16_t>& codes, int lzw_min, std::vector<uint8_t>& out)
+{
+    int clear_code = 1 << lzw_min;
+    int code_size = lzw_min + 1, next_code = clear_code + 2;
+    uint32_t acc = 0;
+    int nbits = 0;
+    std::vector<uint8_t> packed;
+
+    auto write = [&](int code)
+    {
+        acc |= uint32_t(code) << nbits;
+        nbits += code_size;
+
+        while (nbits >= 8)
+        {
+            packed.push_back(acc & 0xFF);
+            acc >>= 8;
+            nbits -= 8;
+        }
+    };
+
+    write(clear_code);
+
+    for (uint16_t code : codes)
+    {
+        write(code);
+
+        if (code == clear_code)
+        {
+            code_size = lzw_min + 1;
+            next_code = clear_code + 2;
+        }
+        else if (next_code < 0x1000 && ++next_code > (1 << code_size) && code_size < 12)
+        {
+            code_size++;
+        }
+    }
+
+    write(clear_code + 1);
+
+    if (nbits > 0)
+    {
+        packed.push_back(acc & 0xFF);
+    }
+
+    out.push_back(lzw_min);
+
+    for (size_t i = 0; i < packed.size(); i += 255)
+    {
+        size_t nbytes = std::min<size_t>(255, packed.size() - i);
+        out.push_back(nbytes);
+        out.insert(out.end(), packed.begin() + i, packed.begin() + i + nbytes);
+    }
+
+    out.push_back(0);
+}
+
+/* lzw_encode() then lzw_decode(), true if the indices come back */
+bool lzw_round_trip(const std::vector<uint8_t>& indices, size_t width, int lzw_min)
+{
+    std::vector<uint8_t> data, stream, decoded(indices.size());
+    lzw_encode(indices.data(), indices.size(), lzw_min, data);
+
+    size_t at = 1;
+    read_sub_blocks(data, at, stream);
+
+    size_t height = indices.size() / width;
+    size_t rows = lzw_decode(stream.data(), stream.size(), lzw_min, width, height, [&](size_t y, const uint8_t* row)
+    {
+        std::copy(row, row + width, &decoded[y * width]);
+    });
+
+    return data[0] == lzw_min && rows == height && decoded == indices;
+}
+
+void bench_bitwriter(const std::vector<std::string>& files)
+{
+    const size_t ncodes = 1 << 24;
+    std::mt19937 rng(1);
+
+    std::cout << std::setw(10) << "min size" << std::setw(16) << "Mcodes/s" << std::setw(16) << "old Mcodes/s" << std::setw(12) << "same" << std::endl;
+
+    for (int lzw_min : {2, 4, 8})
+    {
+        // codes the way an encoder writes them: below the next table entry, a clear code when it's full
+        int clear_code = 1 << lzw_min;
+        int next_code = clear_code + 2;
+        std::vector<uint16_t> codes(ncodes);
+
+        for (auto& code : codes)
+        {
+            if (next_code == 0x1000)
+            {
+                code = clear_code;
+                next_code = clear_code + 2;
+                continue;
+            }
+
+            code = rng() % next_code;
+            code = code == clear_code ? 0 : code;
+            next_code++;
+        }
+
+        std::vector<uint8_t> out, old;
+
+        double ms = time_ms([&]()
+        {
+            out.clear();
+            LZWWriter writer(lzw_min, out);
+
+            for (uint16_t code : codes)
+            {
+                if (code == clear_code)
+                {
+                    writer.clear();
+                    continue;
+                }
+
+                writer.write(code);
+                writer.add_entry();
+            }
+
+            writer.finish();
+        });
+
+        double old_ms = time_ms([&]()
+        {
+            old.clear();
+            reference_lzw_writer(codes, lzw_min, old);
+        });
+
+        std::cout << std::setw(10) << lzw_min << std::fixed << std::setprecision(1)
+                  << std::setw(16) << ncodes / ms / 1000
+                  << std::setw(16) << ncodes / old_ms / 1000
+                  << std::setw(12) << (out == old ? "yes" : "NO") << std::endl;
+    }
+
+    // round trips through the decoder: noise, runs and sizes around sub-block boundaries
+    size_t passed = 0, failed = 0;
+
+    for (int lzw_min = 2; lzw_min <= 8; ++lzw_min)
+    {
+        for (size_t n : {1, 2, 3, 254, 255, 256, 1021, 4096, 65537, 400000})
+        {
+            std::vector<uint8_t> noise(n), runs(n);
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                noise[i] = rng() % (1 << lzw_min);
+                runs[i] = i > 0 && rng() % 16 ? runs[i - 1] : rng() % (1 << lzw_min);
+            }
+
+            for (auto* indices : {&noise, &runs})
+            {
+                lzw_round_trip(*indices, 1, lzw_min) ? passed++ : failed++;
+            }
+        }
+    }
+
+    for (auto& file : files)
+    {
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif))
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        for (auto& f : gif.frames)
+        {
+            decode_image(gif, *f.image);
+            lzw_round_trip(f.image->index, f.image->width, f.image->lzw_min) ? passed++ : failed++;
+        }
+    }
+
+    std::cout << passed << " round trips through lzw_decode() passed, " << failed << " failed" << std::endl;
+}
+
+void bench_input(const std::vector<std::string>& files)
+{
+    // I420 to BGRA, plain vs SSE2, on a 720p frame and a small odd-sized one
+    for (auto size : {std::make_pair(1280, 720), std::make_pair(97, 31)})
+    {
+        size_t width = size.first, height = size.second;
+        size_t chroma = ((width + 1) / 2) * ((height + 1) / 2);
+        std::vector<uint8_t> planes(width * height + 2 * chroma);
+        std::vector<uint32_t> plain(width * height), simd(width * height);
+        std::mt19937 rng(1);
+
+        for (auto& b : planes)
+        {
+            b = rng();
+        }
+
+        const uint8_t* y = planes.data();
+        const uint8_t* u = y + width * height;
+        const uint8_t* v = u + chroma;
+
+        double plain_ms = time_ms([&]() { i420_to_bgra(y, u, v, width, height, plain.data(), false); });
+        double simd_ms = time_ms([&]() { i420_to_bgra(y, u, v, width, height, simd.data()); });
+
+        std::cout << "I420 " << width << "x" << height << ": " << std::fixed << std::setprecision(1)
+                  << width * height / plain_ms / 1000 << " MP/s plain, "
+                  << width * height / simd_ms / 1000 << " MP/s SSE2, "
+                  << (plain == simd ? "same" : "DIFFERENT") << std::endl;
+    }
+
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(12) << "1 thread"
+              << std::setw(12) << "pipelined"
+              << std::setw(10) << "same" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+        std::vector<std::vector<uint32_t>> frames;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        decode_frames(gif, frames);
+
+        // the frames as a PAM stream
+        std::ostringstream pam;
+
+        for (auto& f : frames)
+        {
+            pam << "P7\nWIDTH " << gif.canvas_width << "\nHEIGHT " << gif.canvas_height << "\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n";
+
+            for (uint32_t p : f)
+            {
+                pam << char(p >> 16) << char(p >> 8) << char(p);
+            }
+        }
+
+        std::string input = pam.str(), outputs[2];
+        double ms[2];
+
+        for (int threads = 0; threads < 2; ++threads)
+        {
+            ms[threads] = time_ms([&]()
+            {
+                std::istringstream in(input);
+                std::ostringstream out;
+                FrameReader reader(in);
+
+                reader.open();
+
+                StreamEncoder encoder(out, reader.width, reader.height);
+                encode_frames(reader, encoder, 4, threads);
+                encoder.finish();
+
+                outputs[threads] = out.str();
+            }, 1);
+        }
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << frames.size()
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(12) << frames.size() * 1000 / ms[0]
+                  << std::setw(12) << frames.size() * 1000 / ms[1]
+                  << std::setw(10) << (outputs[0] == outputs[1] ? "yes" : "NO") << std::endl;
+    }
+}
+
+void bench_ratecontrol(const std::vector<std::string>& files)
+{
+    const int fractions[] = {2, 4, 10}; // targets: 1/2, 1/4 and 1/10 of the plain encode
+
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(12) << "plain KB"
+              << std::setw(10) << "ms"
+              << std::setw(10) << "target"
+              << std::setw(12) << "KB"
+              << std::setw(24) << "scale/step/colors/lossy"
+              << std::setw(10) << "encodes"
+              << std::setw(10) << "quantize"
+              << std::setw(10) << "ms"
+              << std::setw(12) << "x plain" << std::endl;
+
+    for (auto& file : files)
+    {
+        GIF gif;
+        std::vector<std::vector<uint32_t>> frames;
+        std::vector<int> delays;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty())
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        decode_frames(gif, frames);
+
+        for (auto& f : gif.frames)
+        {
+            delays.push_back(f.delay_time);
+        }
+
+        std::string plain;
+
+        double plain_ms = time_ms([&]()
+        {
+            RateControl rate(frames, delays, gif.canvas_width, gif.canvas_height);
+            rate.encode(SIZE_MAX, plain);
+        }, 1);
+
+        for (int fraction : fractions)
+        {
+            std::string out;
+            RateStats stats;
+
+            double ms = time_ms([&]()
+            {
+                RateControl rate(frames, delays, gif.canvas_width, gif.canvas_height);
+                rate.encode(plain.size() / fraction, out, &stats);
+            }, 1);
+
+            const RateLevel& r = rate_levels[stats.level];
+            std::ostringstream settings;
+            settings << r.scale << "/" << r.step << "/" << r.colors << "/" << stats.lossy;
+
+            std::cout << std::left << std::setw(40) << file << std::right
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(12) << plain.size() / 1024.0
+                      << std::setw(10) << plain_ms
+                      << std::setw(8) << "1/" << std::setw(2) << fraction
+                      << std::setw(12) << out.size() / 1024.0
+                      << std::setw(24) << settings.str()
+                      << std::setw(10) << stats.encodes
+                      << std::setw(10) << stats.prepares
+                      << std::setw(10) << ms
+                      << std::setw(12) << ms / plain_ms << std::endl;
+        }
+    }
+}
+
+/*
+The whole pipeline on each file: decode with a palette effect (sepia on the color tables), resize
+to 1/2 and encode. Time spent in each stage, the time until the first frame is written and in all.
+*/
+void bench_transcode(const std::vector<std::string>& files)
+{
+    std::vector<PaletteEffect> effects(1);
+    parse_effect("sepia", effects[0]);
+
+    std::cout << std::left << std::setw(40) << "file" << std::right
+              << std::setw(8) << "frames"
+              << std::setw(12) << "decode fps"
+              << std::setw(12) << "resize fps"
+              << std::setw(12) << "encode fps"
+              << std::setw(12) << "first ms"
+              << std::setw(10) << "total ms"
+              << std::setw(12) << "in KB"
+              << std::setw(12) << "out KB" << std::endl;
+
+    for (auto& file : files)
+    {
+        typedef std::chrono::duration<double, std::milli> Ms;
+
+        double stage_ms[3] = {0, 0, 0}; // decode, resize, encode
+        double first_ms = 0;
+        size_t frames = 0, in_bytes = 0;
+        std::string out;
+
+        auto start = Clock::now();
+        GIF gif;
+
+        if (!load_gif(file.c_str(), gif) || gif.frames.empty() || gif.canvas_width < 2 || gif.canvas_height < 2)
+        {
+            std::cerr << "Couldn't read GIF file: " << file << std::endl;
+            continue;
+        }
+
+        in_bytes = gif.bytes.size();
+        stage_ms[0] += Ms(Clock::now() - start).count();
+
+        {
+            std::ostringstream file_out;
+            Canvas canvas(gif);
+            Pyramid pyramid(1);
+            StreamEncoder encoder(file_out, gif.canvas_width / 2, gif.canvas_height / 2);
+            size_t header = encoder.stats.bytes_written;
+
+            canvas.effects = effects;
+            encoder.flush_bytes = 0; // to see when the first frame comes out
+
+            for (auto& f : gif.frames)
+            {
+                auto t0 = Clock::now();
+                canvas.draw(f);
+                auto t1 = Clock::now();
+                pyramid.build(canvas.pixels.data(), canvas.width(), canvas.height());
+                auto t2 = Clock::now();
+                encoder.push(pyramid.pixels(1).data(), f.delay_time);
+                auto t3 = Clock::now();
+
+                stage_ms[0] += Ms(t1 - t0).count();
+                stage_ms[1] += Ms(t2 - t1).count();
+                stage_ms[2] += Ms(t3 - t2).count();
+
+                if (first_ms == 0 && encoder.stats.bytes_written > header)
+                {
+                    first_ms = Ms(t3 - start).count();
+                }
+            }
+
+            auto t0 = Clock::now();
+            encoder.finish();
+            stage_ms[2] += Ms(Clock::now() - t0).count();
+
+            if (first_ms == 0)
+            {
+                first_ms = Ms(Clock::now() - start).count(); // a single frame is written by finish()
+            }
+
+            frames = gif.frames.size();
+            out = file_out.str();
+        }
+
+        double total = Ms(Clock::now() - start).count();
+
+        std::cout << std::left << std::setw(40) << file << std::right
+                  << std::setw(8) << frames
+                  << std::fixed << std::setprecision(1);
+
+        for (double ms : stage_ms)
+        {
+            std::cout << std::setw(12) << frames * 1000 / ms;
+        }
+
+        std::cout << std::setprecision(2)
+                  << std::setw(12) << first_ms
+                  << std::setw(10) << total
+                  << std::setw(12) << in_bytes / 1024.0
+                  << std::setw(12) << out.size() / 1024.0 << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::map<std::string, std::function<void(const std::vector<std::string>&)>> benchmarks = {
+        {"roi", bench_roi},
+        {"range", bench_range},
+        {"info", bench_info},
+        {"concat", bench_concat},
+        {"effects", bench_effects},
+        {"filters", bench_filters},
+        {"reverse", bench_reverse},
+        {"overlay", bench_overlay},
+        {"transparent", bench_transparent},
+        {"formats", bench_formats},
+        {"pyramid", bench_pyramid},
+        {"hash", bench_hash},
+        {"motion", bench_motion},
+        {"stream", bench_stream},
+        {"palette", bench_palette},
+        {"optimal", bench_optimal},
+        {"lossy", bench_lossy},
+        {"transparency", bench_transparency},
+        {"output", bench_output},
+        {"bitwriter", bench_bitwriter},
+        {"input", bench_input},
+        {"ratecontrol", bench_ratecontrol},
+        {"transcode", bench_transcode}
+    };
+
+    if (argc <= 2 || benchmarks.count(argv[1]) == 0)
+    {
+        std::cerr << "Usage: gif_bench BENCHMARK [FILE NAME].gif..." << std::endl;
+        std::cerr << "Benchmarks:";
+
+        for (auto& b : benchmarks)
+        {
+            std::cerr << " " << b.first;
+        }
+
+        std::cerr << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> files(argv + 2, argv + argc);
+    benchmarks[argv[1]](files);
+
+    return 0;
+}
@@ -0,0 +1,630 @@
+/*
+Compositing of GIF frames onto a canvas (or onto a rectangle of it)
+*/
+
+#ifndef GIF_CANVAS_H
+#define GIF_CANVAS_H
+
+#include "gif.h"
+#include "gif_effects.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct Rect
+{
+    int left;
+    int top;
+    int width;
+    int height;
+
+    int right() const { return left + width; }
+    int bottom() const { return top + height; }
+    bool empty() const { return width <= 0 || height <= 0; }
+};
+
+inline Rect intersect(const Rect& a, const Rect& b)
+{
+    int left = std::max(a.left, b.left);
+    int top = std::max(a.top, b.top);
+    int right = std::min(a.right(), b.right());
+    int bottom = std::min(a.bottom(), b.bottom());
+
+    return Rect{left, top, std::max(right - left, 0), std::max(bottom - top, 0)};
+}
+
+/* Smallest rectangle holding a and b */
+inline Rect bounding_rect(const Rect& a, const Rect& b)
+{
+    if (a.empty())
+    {
+        return b;
+    }
+
+    if (b.empty())
+    {
+        return a;
+    }
+
+    int left = std::min(a.left, b.left);
+    int top = std::min(a.top, b.top);
+
+    return Rect{left, top, std::max(a.right(), b.right()) - left, std::max(a.bottom(), b.bottom()) - top};
+}
+
+inline Rect frame_rect(const Frame& f)
+{
+    return Rect{f.image->left, f.image->top, int(f.image->width), int(f.image->height)};
+}
+
+/*
+Pixel formats the canvas can write. Each one has a Pixel type and turns a color into a pixel with
+pack(); the palette of a frame is packed once and the pixels are copied from it, so frames come
+out in the requested format without a conversion pass afterwards.
+*/
+struct BGRA32 // see color_rgba, also what SDL calls SDL_PIXELFORMAT_BGRA32
+{
+    typedef uint32_t Pixel;
+    static Pixel pack(uint8_t r, uint8_t g, uint8_t b, uint8_t a) { return color_rgba(r, g, b, a); }
+};
+
+struct RGBA32 // bytes r, g, b, a in memory
+{
+    typedef uint32_t Pixel;
+    static Pixel pack(uint8_t r, uint8_t g, uint8_t b, uint8_t a) { return (a << 24) | (b << 16) | (g << 8) | r; }
+};
+
+struct RGB565
+{
+    typedef uint16_t Pixel;
+    static Pixel pack(uint8_t r, uint8_t g, uint8_t b, uint8_t) { return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3); }
+};
+
+struct RGB24
+{
+    struct Pixel { uint8_t r, g, b; };
+    static Pixel pack(uint8_t r, uint8_t g, uint8_t b, uint8_t) { return Pixel{r, g, b}; }
+};
+
+struct GRAY8
+{
+    typedef uint8_t Pixel;
+    static Pixel pack(uint8_t r, uint8_t g, uint8_t b, uint8_t) { return (77 * r + 150 * g + 29 * b + 128) >> 8; }
+};
+
+/*
+Canvas holding the composited pixels (in Format, see above) of a rectangle of the logical screen.
+By default the rectangle is the whole logical screen; with a smaller region of interest, palette
+expansion, storage and compositing are only done for pixels inside it and frames that do not
+intersect it are not decoded at all.
+
+With clear_background, the background (before the first frame and after disposal method 2) is
+transparent black instead of the background color, which makes the pixels premultiplied (for the
+formats with alpha) ready to be composited onto other content. Only the background pixel differs,
+so compositing takes as long as onto the opaque background (within a few percent on the sample
+files, see gif_bench transparent). Otherwise the effects apply to the background color too, as of
+the frame being drawn.
+*/
+template<typename Format>
+class BasicCanvas
+{
+public:
+    typedef typename Format::Pixel Pixel;
+
+    BasicCanvas(const GIF& gif_, bool clear_background_ = false) :
+        BasicCanvas(gif_, Rect{0, 0, int(gif_.canvas_width), int(gif_.canvas_height)}, clear_background_) {}
+
+    BasicCanvas(const GIF& gif_, const Rect& roi_, bool clear_background_ = false) : gif(&gif_), clear_background(clear_background_)
+    {
+        roi = intersect(roi_, Rect{0, 0, int(gif->canvas_width), int(gif->canvas_height)});
+        bkgd = gif->gct_flag && gif->bkgd_color_idx < int(gif->gct.size()) ? gif->gct[gif->bkgd_color_idx] : Color{255, 255, 255};
+
+        reset();
+    }
+
+    size_t width() const { return roi.width; }
+    size_t height() const { return roi.height; }
+
+    /* Clear to the background color, as before the first frame */
+    void reset()
+    {
+        set_background(0);
+        pixels.assign(size_t(roi.width) * roi.height, bkgd_color);
+        disposal = 0;
+        dirty = Rect{0, 0, 0, 0};
+        fresh = true;
+    }
+
+    /* Dispose of the previous frame and composite frame f on top of the canvas */
+    void draw(const Frame& f)
+    {
+        float t = effects.empty() ? 0 : effect_progress(*gif, f);
+
+        if (!effects.empty())
+        {
+            set_background(t);
+
+            if (fresh)
+            {
+                std::fill(pixels.begin(), pixels.end(), bkgd_color); // effects may have been set after reset()
+            }
+        }
+
+        fresh = false;
+        dispose();
+
+        const Image* img = f.image;
+        Rect r = intersect(frame_rect(f), roi);
+
+        disposal = f.disposal_method;
+        dirty = r;
+
+        if (r.empty())
+        {
+            return; // nothing visible, skip LZW decoding altogether
+        }
+
+        if (disposal == 3)
+        {
+            save_rect(r);
+        }
+
+        const std::vector<Color>* ct = &img->ct;
+
+        if (!effects.empty() || !cycles.empty())
+        {
+            table = img->ct;
+            apply_palette_cycles(cycles, f.start_time, table);
+            apply_palette_effects(effects, t, table);
+            ct = &table;
+        }
+
+        Pixel palette[256];
+
+        for (int i = 0; i < 256; ++i)
+        {
+            Color c = i < int(ct->size()) ? (*ct)[i] : Color{0, 0, 0};
+            palette[i] = Format::pack(c.r, c.g, c.b, 255);
+        }
+
+        int trans_idx = f.transparent ? f.trans_idx : -1;
+
+        auto composite_row = [&](size_t y, const uint8_t* row)
+        {
+            int cy = img->top + int(y);
+
+            if (cy < r.top || cy >= r.bottom())
+            {
+                return;
+            }
+
+            Pixel* dst = &pixels[size_t(cy - roi.top) * roi.width + (r.left - roi.left)];
+            const uint8_t* src = row + (r.left - img->left);
+            int x = 0;
+
+#ifdef __SSE2__
+            if (trans_idx >= 0)
+            {
+                // find transparent pixels 16 at a time: whole runs are skipped or copied without a test per pixel
+                const __m128i trans = _mm_set1_epi8(char(trans_idx));
+
+                for (; x + 16 <= r.width; x += 16)
+                {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+                    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, trans));
+
+                    if (mask == 0)
+                    {
+                        for (int k = 0; k < 16; ++k)
+                        {
+                            dst[x + k] = palette[src[x + k]];
+                        }
+                    }
+                    else if (mask != 0xFFFF)
+                    {
+                        for (int k = 0; k < 16; ++k)
+                        {
+                            if (!(mask & (1 << k)))
+                            {
+                                dst[x + k] = palette[src[x + k]];
+                            }
+                        }
+                    }
+                }
+            }
+#endif
+
+            for (; x < r.width; ++x)
+            {
+                int index = src[x];
+
+                if (index != trans_idx)
+                {
+                    dst[x] = palette[index];
+                }
+            }
+        };
+
+        if (!img->index.empty())
+        {
+            for (size_t y = 0; y < img->height; ++y)
+            {
+                composite_row(y, &img->index[y * img->width]);
+            }
+        }
+        else
+        {
+            read_sub_blocks(gif->bytes, img->data_offset, stream);
+            lzw_decode(stream.data(), stream.size(), img->lzw_min, img->width, img->height, [&](size_t y, const uint8_t* row)
+            {
+                composite_row(img->interlace ? interlaced_row(y, img->height) : y, row);
+            });
+        }
+    }
+
+    /* Apply the disposal method of the last drawn frame */
+    void dispose()
+    {
+        if (dirty.empty())
+        {
+            return;
+        }
+
+        switch (disposal)
+        {
+        case 0: // disposal method not specified
+        case 1: // do not dispose of graphic
+        {
+            break;
+        }
+        case 2: // overwrite graphic with background color
+        {
+            for (int y = dirty.top; y < dirty.bottom(); ++y)
+            {
+                Pixel* dst = &pixels[size_t(y - roi.top) * roi.width + (dirty.left - roi.left)];
+                std::fill(dst, dst + dirty.width, bkgd_color);
+            }
+            break;
+        }
+        case 3: // overwrite graphic with previous graphic
+        {
+            restore_rect(dirty);
+            break;
+        }
+        }
+
+        dirty = Rect{0, 0, 0, 0};
+    }
+
+    const GIF* gif;
+    Rect roi; // the part of the logical screen covered by pixels
+    Pixel bkgd_color;
+    std::vector<Pixel> pixels;
+
+    std::vector<PaletteEffect> effects; // applied to the color table of every frame
+    std::vector<PaletteCycle> cycles; // same, before the effects
+
+private:
+    void set_background(float t)
+    {
+        if (clear_background)
+        {
+            bkgd_color = Format::pack(0, 0, 0, 0);
+            return;
+        }
+
+        Color c = bkgd;
+
+        for (auto& fx : effects)
+        {
+            c = apply_effect(fx, fx.from + (fx.to - fx.from) * t, c);
+        }
+
+        bkgd_color = Format::pack(c.r, c.g, c.b, 255);
+    }
+
+    void save_rect(const Rect& r)
+    {
+        prev.resize(size_t(r.width) * r.height);
+
+        for (int y = 0; y < r.height; ++y)
+        {
+            const Pixel* src = &pixels[size_t(r.top + y - roi.top) * roi.width + (r.left - roi.left)];
+            std::copy(src, src + r.width, &prev[size_t(y) * r.width]);
+        }
+    }
+
+    void restore_rect(const Rect& r)
+    {
+        for (int y = 0; y < r.height; ++y)
+        {
+            const Pixel* src = &prev[size_t(y) * r.width];
+            std::copy(src, src + r.width, &pixels[size_t(r.top + y - roi.top) * roi.width + (r.left - roi.left)]);
+        }
+    }
+
+    bool clear_background; // transparent background
+    Color bkgd; // background color before effects
+    std::vector<Color> table; // color table with effects applied
+    uint8_t disposal; // disposal method of the last drawn frame
+    bool fresh; // nothing drawn since reset()
+    Rect dirty; // visible part of the last drawn frame
+    std::vector<Pixel> prev; // pixels under dirty before the last frame was drawn (disposal method 3)
+    std::vector<uint8_t> stream; // scratch buffer for LZW data
+};
+
+typedef BasicCanvas<BGRA32> Canvas;
+
+/*
+Decode the animation restricted to the canvas rectangle roi. LZW still runs over every frame that
+intersects roi, but frames outside of it are skipped. frame_fn(frame_number, canvas) is called after
+each frame is composited.
+*/
+template<typename FrameFn>
+void decode_roi(const GIF& gif, const Rect& roi, FrameFn frame_fn)
+{
+    Canvas canvas(gif, roi);
+
+    for (size_t i = 0; i < gif.frames.size(); ++i)
+    {
+        canvas.draw(gif.frames[i]);
+        frame_fn(i, canvas);
+    }
+}
+
+/* Last keyframe at or before frame i */
+inline size_t keyframe_before(const GIF& gif, size_t i)
+{
+    while (i > 0 && !gif.frames[i].keyframe)
+    {
+        i--;
+    }
+
+    return i;
+}
+
+/*
+Composites the original animation on demand for the frames that have to be re-encoded, moving
+forward from the nearest keyframe so frames in between are decoded at most once.
+*/
+class Snapshots
+{
+public:
+    Snapshots(const GIF& gif_, const std::vector<PaletteEffect>& effects = {}) : gif(gif_), canvas(gif_), next(0)
+    {
+        canvas.effects = effects;
+    }
+
+    /* Canvas as it looks right after frame i was drawn; i must not go backwards */
+    const Canvas& at(size_t i)
+    {
+        size_t keyframe = keyframe_before(gif, i);
+
+        if (next == 0 || keyframe >= next)
+        {
+            canvas.reset();
+            next = keyframe;
+        }
+
+        for (; next <= i; ++next)
+        {
+            canvas.draw(gif.frames[next]);
+        }
+
+        return canvas;
+    }
+
+    /* Canvas as frame i is drawn onto it: after frame i - 1 and its disposal; i must not go backwards */
+    const Canvas& before(size_t i)
+    {
+        if (i == 0)
+        {
+            canvas.reset();
+            next = 0;
+            return canvas;
+        }
+
+        at(i - 1);
+        canvas.dispose();
+
+        return canvas;
+    }
+
+private:
+    const GIF& gif;
+    Canvas canvas;
+    size_t next; // next frame to draw
+};
+
+/*
+Composite frames first to last (inclusive) and call frame_fn(frame_number, canvas) for each of them.
+The canvas is rebuilt starting from the nearest keyframe, so only the frames between that keyframe
+and first are decoded in addition to the requested ones.
+*/
+template<typename FrameFn>
+void decode_frame_range(const GIF& gif, size_t first, size_t last, FrameFn frame_fn)
+{
+    if (first > last || last >= gif.frames.size())
+    {
+        return;
+    }
+
+    Canvas canvas(gif);
+
+    for (size_t i = keyframe_before(gif, first); i <= last; ++i)
+    {
+        canvas.draw(gif.frames[i]);
+
+        if (i >= first)
+        {
+            frame_fn(i, canvas);
+        }
+    }
+}
+
+/*
+Find the frames on screen between start_ms and end_ms (exclusive) of the first loop of the animation.
+Returns false if the range is empty, ends before the animation starts or starts after its end.
+*/
+inline bool find_time_range(const GIF& gif, int start_ms, int end_ms, size_t& first, size_t& last)
+{
+    if (gif.frames.empty() || end_ms <= start_ms || end_ms <= 0)
+    {
+        return false;
+    }
+
+    const Frame& end = gif.frames.back();
+
+    if (start_ms >= (end.start_time + end.delay_time) * 10 && start_ms > 0)
+    {
+        return false;
+    }
+
+    // frames are sorted by start time, the frame on screen at t is the last one starting at or before t
+    auto starts_after = [](int t, const Frame& f) { return t < f.start_time * 10; };
+
+    auto on_screen = [&](int t) { return std::upper_bound(gif.frames.begin(), gif.frames.end(), t, starts_after) - gif.frames.begin() - 1; };
+    auto from = on_screen(std::max(start_ms, 0));
+    auto to = on_screen(end_ms - 1);
+
+    if (from < 0 || to < from)
+    {
+        return false;
+    }
+
+    first = from;
+    last = to;
+
+    return true;
+}
+
+/* Same as decode_frame_range() for the frames on screen between start_ms and end_ms */
+template<typename FrameFn>
+bool decode_time_range(const GIF& gif, int start_ms, int end_ms, FrameFn frame_fn)
+{
+    size_t first, last;
+
+    if (!find_time_range(gif, start_ms, end_ms, first, last))
+    {
+        return false;
+    }
+
+    decode_frame_range(gif, first, last, frame_fn);
+    return true;
+}
+
+/*
+Random access to composited frames, for playing backwards. Going forward a canvas is simply drawn
+frame after frame; on the way it leaves a copy of itself every `interval` frames (checkpoints,
+not needed where a keyframe starts over from a blank canvas anyway). A frame behind the current
+one is served from a cache holding the composited pixels of its whole segment, which is filled by
+drawing forward from the checkpoint before it. Walking backwards thus draws every frame about
+once, while at most frames / interval + interval canvases are kept; the default interval is the
+square root of the number of frames.
+*/
+class FrameCache
+{
+public:
+    /* canvas: the canvas to play on, with its region of interest and effects set up */
+    FrameCache(const Canvas& canvas_, size_t interval_ = 0) : gif(*canvas_.gif), canvas(canvas_), interval(interval_), next(0), segment_first(0)
+    {
+        if (interval == 0)
+        {
+            interval = std::max<size_t>(1, size_t(std::ceil(std::sqrt(double(gif.frames.size())))));
+        }
+
+        checkpoints.resize((gif.frames.size() + interval - 1) / interval);
+        canvas.reset();
+    }
+
+    /* Canvas pixels as they look right after frame i was drawn */
+    const std::vector<uint32_t>& at(size_t i)
+    {
+        if (i >= next && i - next < interval)
+        {
+            while (next <= i)
+            {
+                advance();
+            }
+
+            return canvas.pixels;
+        }
+
+        if (i < segment_first || i >= segment_first + segment.size())
+        {
+            fill(i / interval);
+        }
+
+        return segment[i - segment_first];
+    }
+
+    /* Number of canvases held in memory besides the working one */
+    size_t cached() const
+    {
+        size_t n = segment.size();
+
+        for (auto& c : checkpoints)
+        {
+            n += c != nullptr;
+        }
+
+        return n;
+    }
+
+private:
+    void advance()
+    {
+        canvas.draw(gif.frames[next++]);
+
+        if (next % interval == 0 && next < gif.frames.size() && !gif.frames[next].keyframe && checkpoints[next / interval] == nullptr)
+        {
+            checkpoints[next / interval].reset(new Canvas(canvas));
+        }
+    }
+
+    /* Composite the frames of segment s into the cache */
+    void fill(size_t s)
+    {
+        size_t first = s * interval;
+        size_t end = std::min(first + interval, gif.frames.size());
+
+        if (checkpoints[s] != nullptr)
+        {
+            canvas = *checkpoints[s];
+        }
+        else
+        {
+            // no checkpoint yet (or a keyframe starts the segment): replay from the keyframe
+            canvas.reset();
+
+            for (next = keyframe_before(gif, first); next < first;)
+            {
+                advance();
+            }
+        }
+
+        segment.resize(end - first);
+        segment_first = first;
+
+        for (next = first; next < end;)
+        {
+            advance();
+            segment[next - 1 - first] = canvas.pixels;
+        }
+    }
+
+    const GIF& gif;
+    Canvas canvas; // working canvas, frames before next are drawn on it
+    size_t interval;
+    size_t next; // next frame to draw on canvas
+    std::vector<std::unique_ptr<Canvas>> checkpoints; // canvas before frame s * interval
+    std::vector<std::vector<uint32_t>> segment; // pixels after each frame of the cached segment
+    size_t segment_first; // first frame of the cached segment
+};
+
+#endif
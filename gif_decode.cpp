@@ -8,598 +8,190 @@ Resources:
 - http://www.daubnet.com/en/file-format-gif
 - https://www.cs.albany.edu/~sdc/csi333/Fal07/Lect/L18/Summary
 
-to compile: g++ gif_decode.cpp -o gif_decode -std=c++14 -lSDL2
+to compile: g++ gif_decode.cpp -o gif_decode -std=c++14 -O2 -pthread -lSDL2
 
-TODO:
-- debug I80i4.gif
-- better data structure for lzw table
-- use a state machine for decoding process?
+The parser and LZW decoder live in gif.h, compositing in gif_canvas.h. Delay times of 0 and 1
+are played as 10 (hundredths of a second), as browsers do.
 */
 
-#include <iostream>
-#include <iomanip>
-#include <fstream>
-#include <vector>
-#include <unordered_map>
-#include <bitset>
-#include <string>
-#include <sstream>
-#include <memory>
+#include "gif.h"
+#include "gif_canvas.h"
+#include "gif_filters.h"
+#include "gif_pyramid.h"
 
-#include <cassert>
+#include <cstdlib>
+#include <cstdio>
 
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
 
-typedef enum BlockType
-{
-    BT_IMAGE = 0,
-    BT_GRAPHIC_CONTROL,
-    BT_APPLICATION_EXTENSION,
-    BT_COMMENT_BLOCK
-} BlockType;
-
-struct Color
-{
-    uint8_t r;
-    uint8_t g;
-    uint8_t b;
-};
-
-/* Base class for a "meaningful" block for GIF */
-class GIFBlock
-{
-public:
-    GIFBlock() = default;
-    GIFBlock(BlockType type_) : type(type_) {}
-    virtual ~GIFBlock() = default;
-
-    BlockType type;
-};
-
-class Image : public GIFBlock
-{
-public:
-    Image() : GIFBlock(BT_IMAGE) {}
-
-    size_t width;
-    size_t height;
-    int left;
-    int top;
-    bool interlace;
-
-    std::vector<Color> ct;
-    std::vector<int> index;
-};
-
-class GraphicsControl : public GIFBlock
-{
-public:
-    GraphicsControl() : GIFBlock(BT_GRAPHIC_CONTROL) {}
-
-    bool transparent;
-    bool user_input;
-    uint8_t disposal_method;
-    int delay_time;
-    uint8_t color_index; /* for transparency */
-};
-
-class ApplicationExtension : public GIFBlock
-{
-public:
-    ApplicationExtension() : GIFBlock(BT_APPLICATION_EXTENSION) {}
-
-    char appid[8];
-    int8_t authcode[3];
-
-    std::vector<std::vector<int8_t>> data_blocks;
-};
-
-class CommentBlock : public GIFBlock
-{
-public:
-    CommentBlock() : GIFBlock(BT_COMMENT_BLOCK) {}
-
-    std::vector<std::string> comments;
-};
-
-const std::string block_type_str[4] = {
-    "IMAGE",
-    "GRAPHIC CONTROL",
-    "APPLICATION EXTENSION",
-    "COMMENT EXTENSION"
-};
-
-const std::string disposal_method_str[4] = {
-    "disposal method not specified",
-    "do not dispose of graphic",
-    "overwrite graphic with background color",
-    "overwrite graphic with previous graphic"
-};
-
-inline bool get_bit(int8_t n, int p)
-{
-    return (n & (1 << (p))) != 0;
-}
-
-/* retrieve value from n starting from bit position p with length l (e.g. ge_val(0b10010001, 4, 4) = 0b1001) */
-inline int8_t get_val(int8_t n, int p, int l)
-{
-    return (n >> p) & ((1 << l) - 1);
-}
-
-template<typename T>
-std::string HexToString(T uval)
-{
-    std::stringstream ss;
-    ss << "0x" << std::setw(sizeof(uval) * 2) << std::setfill('0') << std::hex << +uval;
-    return ss.str();
-}
-
-int fetch_code(const std::string& stream, int& pos, int code_size)
-{
-    pos -= code_size;
-    return std::stoi(stream.substr(pos, code_size), nullptr, 2);
-}
-
-std::unordered_map<int, std::vector<int>> init_table(int ncolors, int code_size, int clear_code, int eoi_code)
-{
-    std::unordered_map<int, std::vector<int>> table;
-
-    for (int i = 0; i < clear_code; ++i)
-    {
-        table[i] = std::vector<int>({i});
-    }
-
-    // the program will crush if i dont add these lines. idk
-    table[clear_code] = std::vector<int>();
-    table[eoi_code] = std::vector<int>();
-
-    return table;
-}
-
-std::string DebugVector(const std::vector<int>& v)
-{
-    if (v.size() == 0)
-    {
-        return "{}";
-    }
-
-    std::string s = "{";
-
-    for (int i = 0; i < v.size(); ++i)
-    {
-        s += std::to_string(int(v[i])) + ((i == v.size() - 1) ? "}" : ", ");
-    }
-
-    return s;
-}
-
-inline uint32_t color_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
-{
-    return (a << 24) | (r << 16) | (g << 8) | b;
-}
-
 int main(int argc, char *argv[])
 {
     if (argc <= 1)
     {
-        std::cerr << "Usage: gif_decoder [FILE NAME].gif" << std::endl;
+        std::cerr << "Usage: gif_decoder [FILE NAME].gif [--roi LEFT,TOP,WIDTH,HEIGHT] [--frames FIRST-LAST] [--time START-END] [--effect SPEC] [--filter SPEC] [--reverse] [--pingpong] [--transparent] [--level N]" << std::endl;
         return 1;
     }
 
-    std::ifstream gif(argv[1]);
-    std::vector<uint8_t> bytes;
-
-    gif.seekg(0, gif.end);
-    size_t length = gif.tellg();
-    gif.seekg(0, gif.beg);
+    GIF gif;
 
-    if (length > 0)
+    if (!load_gif(argv[1], gif))
     {
-        bytes.resize(length);
-        gif.read(reinterpret_cast<char*>(bytes.data()), length);
-    }
-
-    /* Process header block - bytes 0 to 5 */
-
-    bool bGIF89a = bytes[4] == 0x39;
-/*
-    std::cerr << "HEADER BLOCK" << std::endl;
-    std::cerr << bytes[0] << " - " << HexToString(bytes[0]) << std::endl; // G
-    std::cerr << bytes[1] << " - " << HexToString(bytes[1]) << std::endl; // I
-    std::cerr << bytes[2] << " - " << HexToString(bytes[2]) << std::endl; // F
-    std::cerr << bytes[3] << " - " << HexToString(bytes[3]) << std::endl; // 8
-    std::cerr << bytes[4] << " - " << HexToString(bytes[4]) << std::endl; // 7 or 9
-    std::cerr << bytes[5] << " - " << HexToString(bytes[5]) << std::endl; // a
-    std::cerr << std::endl;
-*/
-    assert(bGIF89a); /// support version 89a for now
-
-    /* Process logical screen descriptor bytes 6 to 12 */
-
-    size_t canvas_width = bytes[6] | (bytes[7] << 8); // data are stored in little-endian format
-    size_t canvas_height = bytes[8] | (bytes[9] << 8);
-
-    int8_t packed_field = bytes[10];
-
-    bool gct_flag = get_bit(packed_field, 7); // most significant bit
-    uint8_t N = get_val(packed_field, 4, 3); // color resolution
-    size_t gct_size = get_val(packed_field, 0, 3);
-    int bkgd_color_idx = bytes[11];
-/*
-    std::cerr << "LOGICAL SCREEN DESCRIPTOR" << std::endl;
-    std::cerr << "Canvas width: " << canvas_width << std::endl;
-    std::cerr << "Canvas height: " << canvas_height << std::endl;
-    std::cerr << "Global color table flag: " << gct_flag << std::endl;
-    std::cerr << "Color resolution: " << int(N) << std::endl;
-    std::cerr << "Global color table size: " << gct_size << std::endl;
-    std::cerr << "Background color index: " << bkgd_color_idx << std::endl;
-    std::cerr << std::endl;
-*/
-    int idx = 13;
-
-    std::vector<Color> gct;
-    size_t ncolors = 1 << (gct_size + 1);
-
-    /* Process global color table (optional) */
-
-    if (gct_flag)
-    {
-        //std::cerr << "GLOBAL COLOR TABLE" << std::endl;
-
-        for (int i = 0; i < ncolors; ++i)
-        {
-            Color color;
-
-            color.r = bytes[idx++];
-            color.g = bytes[idx++];
-            color.b = bytes[idx++];
-
-            gct.push_back(color);
-
-            //std::cerr << "Red: " << int(gct[i].r) << ", Green: " << int(gct[i].g) << ", Blue: " << int(gct[i].b) << std::endl;
-        }
-
-        //std::cerr << std::endl;
+        std::cerr << "Couldn't read GIF file: " << argv[1] << std::endl;
+        return 1;
     }
 
-    /* Process graphics control extension, application extension, comment extension, etc. until eof */
-
-    std::vector<std::unique_ptr<GIFBlock>> blocks;
-
-    bool done = false;
+    Rect roi{0, 0, int(gif.canvas_width), int(gif.canvas_height)};
+    size_t first = 0;
+    size_t last = gif.frames.empty() ? 0 : gif.frames.size() - 1;
+    std::vector<PaletteEffect> effects;
+    FilterChain filters;
+    bool reverse = false;
+    bool pingpong_flag = false;
+    bool transparent = false;
+    int level = 0; // show the canvas at 1/2^level of its size
 
-    /* http://giflib.sourceforge.net/whatsinagif/gif_file_stream.gif */
-    while (!done)
+    for (int a = 2; a < argc; ++a)
     {
-        uint8_t b = bytes[idx++];
-        //std::cerr << HexToString(b) << std::endl;
+        std::string arg = argv[a];
 
-        switch (b)
-        {
-        case 0x2C: // Image descriptor
+        if (arg == "--roi" && a + 1 < argc)
         {
-            Image i;
-
-            i.left = bytes[idx++] | (bytes[idx++] << 8);
-            i.top = bytes[idx++] | (bytes[idx++] << 8);
-            i.width = bytes[idx++] | (bytes[idx++] << 8);
-            i.height = bytes[idx++] | (bytes[idx++] << 8);
-
-            int8_t packed_field = bytes[idx++];
-
-            i.interlace = get_bit(packed_field, 6);
-
-            bool lct_flag = get_bit(packed_field, 7); // most significant bit
-            size_t lct_size = get_val(packed_field, 0, 3);
-/*
-            std::cerr << "IMAGE DESCRIPTOR" << std::endl;
-            std::cerr << "Left: " << i.left << std::endl;
-            std::cerr << "Top: " << i.top << std::endl;
-            std::cerr << "Width: " << i.width << std::endl;
-            std::cerr << "Height: " << i.height << std::endl;
-            std::cerr << "Interlaced: " << i.interlace << std::endl;
-            std::cerr << "Local color table flag: " << lct_flag << std::endl;
-            std::cerr << std::endl;
-*/
-            /* Process local color table (optional) */
-
-            if (lct_flag)
+            if (std::sscanf(argv[++a], "%d,%d,%d,%d", &roi.left, &roi.top, &roi.width, &roi.height) != 4)
             {
-                size_t ncolors = 1 << (lct_size + 1);
-                std::vector<Color> lct;
-
-                //std::cerr << "LOCAL COLOR TABLE" << std::endl;
-
-                for (int i = 0; i < ncolors; ++i)
-                {
-                    Color color;
-
-                    color.r = bytes[idx++];
-                    color.g = bytes[idx++];
-                    color.b = bytes[idx++];
-
-                    lct.push_back(color);
-
-                    //std::cerr << "Red: " << int(lct[i].r) << ", Green: " << int(lct[i].g) << ", Blue: " << int(lct[i].b) << std::endl;
-                }
-
-                //std::cerr << std::endl;
-
-                i.ct = lct;
+                std::cerr << "Bad region of interest: " << argv[a] << std::endl;
+                return 1;
             }
-            else
+        }
+        else if (arg == "--frames" && a + 1 < argc)
+        {
+            if (std::sscanf(argv[++a], "%zu-%zu", &first, &last) != 2 || first > last || last >= gif.frames.size())
             {
-                i.ct = gct; // use global color table instead
+                std::cerr << "Bad frame range: " << argv[a] << std::endl;
+                return 1;
             }
+        }
+        else if (arg == "--time" && a + 1 < argc)
+        {
+            double start, end; // in seconds
 
-            /* Fun part begins here */
-
-            size_t lzw_min = bytes[idx++]; // minimum number of bits to represent a color (or pixel)
-            size_t ncolors = i.ct.size();
-
-            // Before decoding, let's prepare a stream of bytes (in binary)
-
-            std::string stream = "";
-
-            while (true)
+            if (std::sscanf(argv[++a], "%lf-%lf", &start, &end) != 2 ||
+                !find_time_range(gif, int(start * 1000), int(end * 1000), first, last))
             {
-                size_t nbytes = bytes[idx++]; // size of a data sub-block
-                //std::cerr << "LZW data block size: " << nbytes << std::endl;
-
-                if (nbytes == 0)
-                {
-                    break;
-                }
-
-                for (int i = 0; i < nbytes; ++i)
-                {
-                    stream = std::bitset<8>(bytes[idx++]).to_string() + stream;
-                }
+                std::cerr << "Bad time range: " << argv[a] << std::endl;
+                return 1;
             }
+        }
+        else if (arg == "--effect" && a + 1 < argc)
+        {
+            PaletteEffect fx;
 
-            int first_code_size = lzw_min + 1; // number of bits needed for first code; 
-            int code_size = first_code_size; // can be changed when necessary
-
-            int clear_code = 1 << lzw_min;
-            int eoi_code = clear_code + 1;
-
-            std::unordered_map<int, std::vector<int>> table = init_table(ncolors, first_code_size, clear_code, eoi_code);
-            std::vector<int> index_stream; // output we want
-
-            int pos = stream.length();
-            int code = fetch_code(stream, pos, code_size); // the first code should be the clear code and we just cleared so no need to do again
-            int prev; // old code
-            int table_index = eoi_code + 1; // counter for adding new entries to the table
-
-            code = fetch_code(stream, pos, code_size); // our first color code
-            index_stream.push_back(code);
-            prev = code;
-
-            int step = 1;
-            //std::cerr << "LZW DECODING" << std::endl;
-
-            while (true)
+            if (!parse_effect(argv[++a], fx))
             {
-                code = fetch_code(stream, pos, code_size);
-
-                //std::cerr << "Step " << step << ": code=0b" << std::bitset<12>(code) << std::endl;
-
-                if (code == clear_code)
-                {
-                    //std::cerr << "Reached CLEAR code" << std::endl;
-
-                    code_size = first_code_size;
-                    table = init_table(ncolors, code_size, clear_code, eoi_code);
-                    table_index = eoi_code + 1;
-
-                    code = fetch_code(stream, pos, code_size); // again, our first color code
-                    index_stream.push_back(code);
-                    prev = code;
-
-                    continue;
-                }
-                else if (code == eoi_code)
-                {
-                    //std::cerr << "Reached EOI code" << std::endl;
-                    break;
-                }
-
-                int k = 0;
-
-                if (code >= table.size())
-                {
-                    k = table[prev][0];
-                    index_stream.insert(index_stream.end(), table[prev].begin(), table[prev].end());
-                    index_stream.push_back(k);
-                }
-                else // code exists in the table
-                {
-                    index_stream.insert(index_stream.end(), table[code].begin(), table[code].end());
-                    k = table[code][0];
-                }
-
-                if (table_index < 0x1000)
-                {
-                    table[table_index] = table[prev];
-                    table[table_index].push_back(k);
-                    table_index++;
-
-                    if (table.size() == (1 << code_size) && code_size < 12)
-                    {
-                        code_size++; // increase as soon as the index is equal to 2^(code_size)-1
-                    }
-                }
-
-                prev = code;
-
-                //std::cerr << "Step " << step << " result: index=" << DebugVector(index_stream) << std::endl;
-                step++;
+                std::cerr << "Unknown effect: " << argv[a] << std::endl;
+                return 1;
             }
-/*
-            std::cerr << std::endl;
 
-            std::cerr << "LZW CODE TABLE" << std::endl;
+            effects.push_back(fx);
+        }
+        else if (arg == "--filter" && a + 1 < argc)
+        {
+            Filter filter;
 
-            for (int i = 0; i < table_index; ++i)
+            if (!parse_filter(argv[++a], filter))
             {
-                std::cerr << "#" << i << ": " << DebugVector(table[i]) << std::endl;
+                std::cerr << "Bad filter: " << argv[a] << std::endl;
+                return 1;
             }
-*/
-            //std::cerr << std::endl;
 
-            i.index = index_stream;
-            assert(i.index.size() == i.width * i.height);
-            blocks.push_back(std::make_unique<Image>(i));
-
-            break;
+            filters.filters.push_back(filter);
+        }
+        else if (arg == "--reverse")
+        {
+            reverse = true;
+        }
+        else if (arg == "--pingpong")
+        {
+            pingpong_flag = true;
+        }
+        else if (arg == "--transparent")
+        {
+            transparent = true;
         }
-        case 0x21: // Extension introducer
+        else if (arg == "--level" && a + 1 < argc)
         {
-            uint8_t label = bytes[idx++];
+            level = std::atoi(argv[++a]);
 
-            switch (label)
-            {
-            case 0xF9: // Graphic control extension (optional)
+            if (level < 0 || level > 3)
             {
-                GraphicsControl gc;
-
-                size_t block_size = bytes[idx++]; // always 4
-
-                int8_t packed = bytes[idx++];
-
-                gc.transparent = get_bit(packed, 0);
-                gc.user_input = get_bit(packed, 1);
-                gc.disposal_method = get_val(packed, 2, 3);
-
-                gc.delay_time = bytes[idx++] | (bytes[idx++] << 8);
-                gc.color_index = bytes[idx++];
-
-                idx++; // skip the terminator
-
-                blocks.push_back(std::make_unique<GraphicsControl>(gc));
-/*
-                std::cerr << "GRAPHIC CONTROL EXTENSION" << std::endl;
-                std::cerr << "Is transparent: " << gc.transparent << std::endl;
-                std::cerr << "User input enabled: " << gc.user_input << std::endl;
-                std::cerr << "Disposal method: " << disposal_method_str[gc.disposal_method] << std::endl;
-                std::cerr << "Delay time: " << gc.delay_time << std::endl;
-                std::cerr << "Transparent color index: " << int(gc.color_index) << std::endl;
-                std::cerr << std::endl;
-*/
-                break;
+                std::cerr << "Bad level (0 - 3): " << argv[a] << std::endl;
+                return 1;
             }
-            case 0xFF: // Application extension
-            {
-                ApplicationExtension ae;
-
-                size_t block_size = bytes[idx++]; // always 11
-
-                for (int i = 0; i < 8; ++i) ae.appid[i] = bytes[idx++]; // Application identifier
-                for (int i = 0; i < 3; ++i) ae.authcode[i] = bytes[idx++]; // Application auth code
-/*
-                std::cerr << "APPLICATION EXTENSION" << std::endl;
-                std::cerr << "App id: " << ae.appid << std::endl;
-                std::cerr << "App auth code: " << ae.authcode << std::endl;
-                std::cerr << std::endl;
-*/
-                while (true)
-                {
-                    size_t nbytes = bytes[idx++]; // size of a data sub-block
-                    if (nbytes == 0) break;
-
-                    std::vector<int8_t> data;
+        }
+    }
 
-                    for (int i = 0; i < nbytes; ++i)
-                    {
-                        data.push_back(bytes[idx++]);
-                    }
+    std::cerr << "LIST OF BLOCKS" << std::endl;
 
-                    ae.data_blocks.push_back(data);
-                }
+    for (size_t i = 0; i < gif.blocks.size(); ++i)
+    {
+        std::cerr << block_type_str[gif.blocks[i]->type] << std::endl;
 
-                blocks.push_back(std::make_unique<ApplicationExtension>(ae));
+        if (gif.blocks[i]->type == BT_COMMENT_BLOCK)
+        {
+            CommentBlock* ce = dynamic_cast<CommentBlock*>(gif.blocks[i].get());
 
-                break;
-            }
-            case 0x01: // Plain text extension (ignored)
+            for (auto comment : ce->comments)
             {
-                uint8_t skip = bytes[idx++]; // how many bytes to skip
-                idx += skip;
-
-                while (true)
-                {
-                    size_t nbytes = bytes[idx++]; // size of a data sub-block
-                    if (nbytes == 0) break;
-                    for (int i = 0; i < nbytes; ++i, ++idx)
-                        ;
-                }
-/*
-                std::cerr << "PLAIN TEXT EXTENSION" << std::endl;
-                std::cerr << std::endl;
-*/
-                break;
+                std::cerr << comment << std::endl;
             }
-            case 0xFE: // Comment extension
-            {
-                CommentBlock cb;
-
-                //std::cerr << "COMMENT EXTENSION" << std::endl;
+        }
+    }
 
-                while (true)
-                {
-                    size_t nbytes = bytes[idx++]; // size of a data sub-block
-                    if (nbytes == 0) break;
+    if (gif.frames.empty())
+    {
+        std::cerr << "Nothing to show" << std::endl;
+        return 1;
+    }
 
-                    std::string comment = "";
+    EffectScript script; // playback effects embedded in the file, plus the ones given here
 
-                    for (int i = 0; i < nbytes; ++i)
-                    {
-                        comment += char(bytes[idx++]);
-                    }
+    if (read_effect_script(gif, script))
+    {
+        std::cerr << "Playing embedded effects" << std::endl;
+    }
 
-                    cb.comments.push_back(comment);
+    script.effects.insert(script.effects.end(), effects.begin(), effects.end());
 
-                    //std::cerr << comment << std::endl;
-                }
+    Canvas canvas(gif, roi, transparent);
+    canvas.effects = script.effects;
+    canvas.cycles = script.cycles;
 
-                //std::cerr << std::endl;
+    if (canvas.width() == 0 || canvas.height() == 0)
+    {
+        std::cerr << "Region of interest is outside of the canvas" << std::endl;
+        return 1;
+    }
 
-                blocks.push_back(std::make_unique<CommentBlock>(cb));
+    size_t width = canvas.width() >> level; // of what's shown
+    size_t height = canvas.height() >> level;
 
-                break;
-            }
-            default:
-            {
-                std::cerr << "WTF is this extension: " << HexToString(label) << std::endl;
-                done = true;
-                break;
-            }
-            }
-            break;
-        }
-        case 0x3B: // Trailer
-        {
-            std::cerr << "Finished reading GIF data!" << std::endl;
-            done = true;
-            break;
-        }
-        default:
-        {
-            std::cerr << "WTF: " << HexToString(b) << std::endl;
-            done = true;
-            break;
-        }
-        }
+    if (width == 0 || height == 0)
+    {
+        std::cerr << "Too small for level " << level << std::endl;
+        return 1;
     }
 
-    std::cerr << std::endl;
-    std::cerr << "LIST OF BLOCKS" << std::endl;
+    /* decode every frame we need once so that looping doesn't run LZW again */
+    size_t keyframe = keyframe_before(gif, first);
 
-    for (int i = 0; i < blocks.size(); ++i)
+    for (size_t k = keyframe; k <= last; ++k)
     {
-        std::cerr << block_type_str[blocks[i]->type] << std::endl;
+        Frame& f = gif.frames[k];
+
+        if (!intersect(frame_rect(f), canvas.roi).empty())
+        {
+            decode_image(gif, *f.image);
+        }
     }
 
     if (SDL_Init(SDL_INIT_EVERYTHING) < 0)
@@ -611,8 +203,8 @@ int main(int argc, char *argv[])
     SDL_Window* window = SDL_CreateWindow("GIF Viewer",
                                           SDL_WINDOWPOS_UNDEFINED,
                                           SDL_WINDOWPOS_UNDEFINED,
-                                          canvas_width,
-                                          canvas_height,
+                                          width,
+                                          height,
                                           SDL_WINDOW_SHOWN);
     if (window == nullptr)
     {
@@ -627,30 +219,27 @@ int main(int argc, char *argv[])
         std::exit(1);
     }
 
-    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_BGRA32, SDL_TEXTUREACCESS_STREAMING, canvas_width, canvas_height);
+    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_BGRA32, SDL_TEXTUREACCESS_STREAMING, width, height);
     if (texture == nullptr)
     {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create texture: %s", SDL_GetError());
         std::exit(1);
     }
 
-    int i = 0; // index for blocks list
-    bool loop = false;
-    int delay = 0; // animation rate in milliseconds
-    int disposal = 2;
-    bool doRender = false;
-    int img_left = 0;
-    int img_top = 0;
-    int img_width = 0;
-    int img_height = 0;
-    bool transparent = false;
-    uint8_t trans_idx = 0;
-
-    Color bkgd = gct_flag ? gct[bkgd_color_idx] : Color{255, 255, 255};
-    uint32_t bkgd_color = color_rgba(bkgd.r, bkgd.g, bkgd.b, 255);
+    if (transparent)
+    {
+        // the canvas is premultiplied, show it on top of a checkerboard
+        SDL_SetTextureBlendMode(texture, SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+                                                                    SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD));
+    }
 
-    std::vector<uint32_t> pixels(canvas_width * canvas_height, bkgd_color);
-    std::vector<uint32_t> prev;
+    FrameCache cache(canvas); // plays on a copy of canvas, also backwards
+    bool ping_pong = script.ping_pong || pingpong_flag;
+    bool forward = !reverse;
+    size_t i = forward ? first : last; // index for frames list
+    std::vector<uint32_t> frame; // filtered copy of the canvas
+    Pyramid pyramid(level);
+    std::vector<std::vector<uint32_t>> downscaled(level > 0 ? gif.frames.size() : 0); // frames at 1/2^level, built once
 
     SDL_Event event;
 
@@ -658,86 +247,40 @@ int main(int argc, char *argv[])
 
     while (!quit)
     {
-        GIFBlock* block = blocks[i].get();
-        i = (i + 1) % blocks.size(); // TODO
+        const Frame& f = gif.frames[i];
+        const std::vector<uint32_t>* scaled;
 
-        if (block->type == BT_IMAGE)
+        if (level == 0)
         {
-            Image* img = dynamic_cast<Image*>(block);
-
-            img_left = img->left;
-            img_top = img->top;
-            img_width = img->width;
-            img_height = img->height;
-
-            int row1[img_height];
-            int row2[img_height];
-
-            if (img->interlace)
-            {
-                for (int i = 0; i < img_height; ++i)
-                    row1[i] = i;
-                int j = 0;
-                for (int i = 0; i < img_height; i += 8, j++)  /* Interlace Pass 1 */
-                    row2[i] = row1[j];
-                for (int i = 4; i < img_height; i += 8, j++)  /* Interlace Pass 2 */
-                    row2[i] = row1[j];
-                for (int i = 2; i < img_height; i += 4, j++)  /* Interlace Pass 3 */
-                    row2[i] = row1[j];
-                for (int i = 1; i < img_height; i += 2, j++)  /* Interlace Pass 4 */
-                    row2[i] = row1[j];
-            }
-            else
-            {
-                for (int i = 0; i < img_height; ++i)
-                    row1[i] = row2[i] = i;
-            }
-
-            for (int y = 0; y < img_height; ++y)
+            scaled = &cache.at(i);
+        }
+        else
+        {
+            // only composited and downscaled the first time it's shown, not on every loop
+            if (downscaled[i].empty())
             {
-                for (int x = 0; x < img_width; ++x)
-                {
-                    int index = img->index[row2[y] * img_width + x];
-
-                    if ((transparent && index != trans_idx) || ! transparent)
-                    {
-                        Color c = img->ct[index];
-                        int offset = (img_top + y) * canvas_width + (img_left + x);
-                        pixels[offset] = color_rgba(c.r, c.g, c.b, 255);
-                    }
-                }
+                pyramid.build(cache.at(i).data(), canvas.width(), canvas.height());
+                downscaled[i] = pyramid.pixels(level);
             }
 
-            doRender = true;
+            scaled = &downscaled[i];
         }
-        else if (block->type == BT_GRAPHIC_CONTROL)
-        {
-            GraphicsControl* gc = dynamic_cast<GraphicsControl*>(block);
-
-            disposal = gc->disposal_method;
-            transparent = gc->transparent;
-            delay = gc->delay_time * 10; // TODO what to do when 0?
 
-            if (transparent)
+        if (i == (forward ? last : first))
+        {
+            if (ping_pong && first < last)
             {
-                trans_idx = gc->color_index;
+                forward = !forward; // bounce, without showing the end frame twice
+                i = forward ? i + 1 : i - 1;
             }
-        }
-        else if (block->type == BT_APPLICATION_EXTENSION)
-        {
-            ApplicationExtension* ae = dynamic_cast<ApplicationExtension*>(block);
-            // TODO
-        }
-        else // comment
-        {
-            CommentBlock* ce = dynamic_cast<CommentBlock*>(block);
-
-            for (auto comment : ce->comments)
+            else
             {
-                std::cerr << comment << std::endl;
+                i = forward ? first : last;
             }
-
-            std::cerr << std::endl;
+        }
+        else
+        {
+            i = forward ? i + 1 : i - 1;
         }
 
         if (SDL_PollEvent(&event))
@@ -752,45 +295,39 @@ int main(int argc, char *argv[])
             }
         }
 
-        if (!doRender)
+        const uint32_t* shown = scaled->data();
+
+        if (!filters.filters.empty())
         {
-            continue;
+            frame = *scaled; // the canvas itself must stay as it is for the next frame
+            filters.apply(frame.data(), width, height);
+            shown = &frame[0];
         }
 
-        SDL_UpdateTexture(texture, nullptr, &pixels[0], canvas_width * 4);
-        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-        SDL_RenderPresent(renderer);
+        SDL_UpdateTexture(texture, nullptr, shown, width * 4);
 
-        switch (disposal)
-        {
-        case 0: // disposal method not specified
-        case 1: // do not dispose of graphic
-        {
-            break;
-        }
-        case 2: // overwrite graphic with background color
+        if (transparent)
         {
-            for (int y = 0; y < img_height; ++y)
+            SDL_SetRenderDrawColor(renderer, 153, 153, 153, 255);
+            SDL_RenderClear(renderer);
+            SDL_SetRenderDrawColor(renderer, 102, 102, 102, 255);
+
+            for (int y = 0; y < int(height); y += 8)
             {
-                for (int x = 0; x < img_width; ++x)
+                for (int x = (y / 8 % 2) * 8; x < int(width); x += 16)
                 {
-                    int offset = (img_top + y) * canvas_width + (img_left + x);
-                    pixels[offset] = bkgd_color;
+                    SDL_Rect square{x, y, 8, 8};
+                    SDL_RenderFillRect(renderer, &square);
                 }
             }
-            break;
-        }
-        case 3: // overwrite graphic with previous graphic
-        {
-            pixels = prev;
-            break;
-        }
         }
 
-        prev = pixels;
-        doRender = false;
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderPresent(renderer);
+
+        int delay_time = f.delay_time <= 1 ? 10 : f.delay_time; // most files with these were made for browsers
 
-        SDL_Delay(delay);
+        SDL_Delay(scaled_delay(script, gif, f, delay_time) * 10);
     }
 
     SDL_DestroyRenderer(renderer);
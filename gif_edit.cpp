@@ -0,0 +1,348 @@
+/*
+edit GIFs without decoding them: trim, retime, set loop count, strip extensions
+
+to compile: g++ gif_edit.cpp -o gif_edit -std=c++14 -O2 -pthread
+usage: gif_edit INPUT.gif OUTPUT.gif [OPTIONS]
+       gif_edit --concat OUTPUT.gif INPUT.gif...
+
+options:
+  --frames FIRST-LAST   keep only these frames (counting from 0)
+  --drop N              drop frame N (can be repeated)
+  --delay CS            set the delay time of every frame (in 1/100 s)
+  --loop N|none         set the loop count (0 = forever) or remove it
+  --strip-comments      remove comment extensions
+  --strip-extensions    remove application, plain text and unknown extensions (except the loop count)
+  --effect SPEC         apply a color effect to the color tables (can be repeated), e.g.
+                        grayscale, sepia, invert, hue:DEGREES, brightness:-1..1, contrast:FACTOR,
+                        fade:FROM-TO:RRGGBB; FROM-TO makes the strength change over time
+  --fx SPEC             embed a color effect that the player applies at runtime instead
+  --fx-cycle FIRST:COUNT:STEP
+                        embed a palette cycle: rotate COUNT colors starting at FIRST every STEP 1/100 s
+  --fx-speed FROM-TO    embed a speed ramp (in percent of the original speed)
+  --fx-pingpong         embed ping-pong playback (forward, then backward)
+  --overlay FILE.gif[:X,Y[:OPACITY]]
+                        stamp the first frame of FILE.gif onto every frame at X,Y (after the other edits)
+  --optimize[=N]        recompress every frame as small as LZW allows by searching where to clear
+                        the string table (N candidate positions per frame, 128 by default; slow)
+  --lossy[=N]           recompress every frame allowing colors up to about N levels per channel off
+                        where that makes LZW strings longer (20 by default)
+
+--concat plays the inputs one after another, reusing their compressed frames
+*/
+
+#include "gif.h"
+#include "gif_edit.h"
+#include "gif_lossy.h"
+#include "gif_optimal.h"
+#include "gif_overlay.h"
+
+#include <cstdio>
+
+bool write_file(const char* path, const std::vector<uint8_t>& bytes)
+{
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+
+    if (!file)
+    {
+        std::cerr << "Couldn't write GIF file: " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int concat(int argc, char *argv[])
+{
+    std::vector<GIF> gifs(argc - 3);
+    std::vector<const GIF*> inputs;
+
+    for (int a = 3; a < argc; ++a)
+    {
+        if (!load_gif(argv[a], gifs[a - 3]))
+        {
+            std::cerr << "Couldn't read GIF file: " << argv[a] << std::endl;
+            return 1;
+        }
+
+        inputs.push_back(&gifs[a - 3]);
+    }
+
+    std::vector<uint8_t> out;
+    ConcatStats stats;
+
+    concat_gifs(inputs, out, &stats);
+
+    if (!write_file(argv[2], out))
+    {
+        return 1;
+    }
+
+    std::cerr << stats.frames_copied << " frames copied, "
+              << stats.tables_converted << " given a local color table, "
+              << stats.frames_inserted << " inserted" << std::endl;
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc <= 2)
+    {
+        std::cerr << "Usage: gif_edit INPUT.gif OUTPUT.gif [--frames FIRST-LAST] [--drop N] [--delay CS] [--loop N|none] [--strip-comments] [--strip-extensions] [--effect SPEC] [--fx SPEC] [--fx-cycle FIRST:COUNT:STEP] [--fx-speed FROM-TO] [--fx-pingpong] [--overlay FILE.gif[:X,Y[:OPACITY]]]" << std::endl;
+        std::cerr << "       gif_edit --concat OUTPUT.gif INPUT.gif..." << std::endl;
+        return 1;
+    }
+
+    if (std::string(argv[1]) == "--concat")
+    {
+        return argc > 3 ? concat(argc, argv) : 1;
+    }
+
+    GIF gif;
+
+    if (!load_gif(argv[1], gif))
+    {
+        std::cerr << "Couldn't read GIF file: " << argv[1] << std::endl;
+        return 1;
+    }
+
+    EditOptions opt;
+    opt.keep.assign(gif.frames.size(), true);
+
+    GIF logo;
+    Overlay overlay;
+    size_t optimize = 0; // candidate positions per frame for --optimize, 0 without it
+    int lossy = 0; // --lossy level, 0 without it
+
+    for (int a = 3; a < argc; ++a)
+    {
+        std::string arg = argv[a];
+
+        if (arg == "--frames" && a + 1 < argc)
+        {
+            size_t first, last;
+
+            if (std::sscanf(argv[++a], "%zu-%zu", &first, &last) != 2 || first > last)
+            {
+                std::cerr << "Bad frame range: " << argv[a] << std::endl;
+                return 1;
+            }
+
+            for (size_t i = 0; i < opt.keep.size(); ++i)
+            {
+                opt.keep[i] = opt.keep[i] && i >= first && i <= last;
+            }
+        }
+        else if (arg == "--drop" && a + 1 < argc)
+        {
+            size_t n;
+
+            if (std::sscanf(argv[++a], "%zu", &n) != 1)
+            {
+                std::cerr << "Bad frame number: " << argv[a] << std::endl;
+                return 1;
+            }
+
+            if (n < opt.keep.size())
+            {
+                opt.keep[n] = false;
+            }
+        }
+        else if (arg == "--delay" && a + 1 < argc)
+        {
+            if (std::sscanf(argv[++a], "%d", &opt.delay_time) != 1 || opt.delay_time < 0 || opt.delay_time > 65535)
+            {
+                std::cerr << "Bad delay time: " << argv[a] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--loop" && a + 1 < argc)
+        {
+            std::string loop = argv[++a];
+
+            if (loop == "none")
+            {
+                opt.loop_count = -1;
+            }
+            else if (std::sscanf(loop.c_str(), "%d", &opt.loop_count) != 1 || opt.loop_count < 0 || opt.loop_count > 65535)
+            {
+                std::cerr << "Bad loop count: " << loop << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--strip-comments")
+        {
+            opt.strip_comments = true;
+        }
+        else if (arg == "--strip-extensions")
+        {
+            opt.strip_extensions = true;
+        }
+        else if (arg == "--effect" && a + 1 < argc)
+        {
+            PaletteEffect fx;
+
+            if (!parse_effect(argv[++a], fx))
+            {
+                std::cerr << "Unknown effect: " << argv[a] << std::endl;
+                return 1;
+            }
+
+            opt.effects.push_back(fx);
+        }
+        else if (arg == "--fx" && a + 1 < argc)
+        {
+            PaletteEffect fx;
+
+            if (!parse_effect(argv[++a], fx))
+            {
+                std::cerr << "Unknown effect: " << argv[a] << std::endl;
+                return 1;
+            }
+
+            opt.script.effects.push_back(fx);
+        }
+        else if (arg == "--fx-cycle" && a + 1 < argc)
+        {
+            unsigned first, count;
+            int step;
+
+            if (std::sscanf(argv[++a], "%u:%u:%d", &first, &count, &step) != 3 || first > 255 || count > 256 - first || count > 255 || step <= 0 || step > 65535)
+            {
+                std::cerr << "Bad palette cycle: " << argv[a] << std::endl;
+                return 1;
+            }
+
+            opt.script.cycles.push_back(PaletteCycle{uint8_t(first), uint8_t(count), step});
+        }
+        else if (arg == "--fx-speed" && a + 1 < argc)
+        {
+            if (std::sscanf(argv[++a], "%d-%d", &opt.script.speed_from, &opt.script.speed_to) != 2 ||
+                opt.script.speed_from <= 0 || opt.script.speed_to <= 0 || opt.script.speed_from > 65535 || opt.script.speed_to > 65535)
+            {
+                std::cerr << "Bad speed ramp: " << argv[a] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--fx-pingpong")
+        {
+            opt.script.ping_pong = true;
+        }
+        else if (arg.compare(0, 10, "--optimize") == 0)
+        {
+            optimize = 128;
+
+            if (arg.size() > 10 && (arg[10] != '=' || std::sscanf(arg.c_str() + 11, "%zu", &optimize) != 1 || optimize == 0))
+            {
+                std::cerr << "Bad number of candidates: " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 7, "--lossy") == 0)
+        {
+            lossy = 20;
+
+            if (arg.size() > 7 && (arg[7] != '=' || std::sscanf(arg.c_str() + 8, "%d", &lossy) != 1 || lossy <= 0 || lossy > 255))
+            {
+                std::cerr << "Bad lossy level: " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--overlay" && a + 1 < argc)
+        {
+            std::string spec = argv[++a];
+            size_t colon = spec.find(':');
+            int x = 0, y = 0;
+            float opacity = 1;
+
+            if (colon != std::string::npos && std::sscanf(spec.c_str() + colon + 1, "%d,%d:%f", &x, &y, &opacity) < 2)
+            {
+                std::cerr << "Bad overlay position: " << spec << std::endl;
+                return 1;
+            }
+
+            if (!load_gif(spec.substr(0, colon).c_str(), logo) || !overlay.load(logo, x, y, std::min(std::max(opacity, 0.0f), 1.0f)))
+            {
+                std::cerr << "Couldn't read GIF file: " << spec.substr(0, colon) << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<uint8_t> out;
+    EditStats stats;
+
+    edit_gif(gif, opt, out, &stats);
+
+    std::cerr << stats.frames_copied << " frames copied, "
+              << stats.frames_reencoded << " re-encoded, "
+              << stats.frames_dropped << " dropped, "
+              << stats.frames_inserted << " inserted" << std::endl;
+
+    if (!overlay.pixels.empty())
+    {
+        GIF edited;
+        OverlayStats ostats;
+
+        edited.bytes.swap(out);
+
+        if (!parse_gif(edited))
+        {
+            return 1;
+        }
+
+        overlay_gif(edited, overlay, out, &ostats);
+
+        std::cerr << "overlay: " << ostats.frames_copied << " frames copied, "
+                  << ostats.frames_stamped << " stamped" << std::endl;
+    }
+
+    if (lossy > 0)
+    {
+        GIF edited;
+        RecompressStats lstats;
+
+        edited.bytes.swap(out);
+
+        if (!parse_gif(edited))
+        {
+            return 1;
+        }
+
+        lossy_gif(edited, lossy, out, &lstats);
+
+        std::cerr << "lossy: " << lstats.frames_recompressed << " frames recompressed, image data "
+                  << lstats.bytes_before << " -> " << lstats.bytes_after << " bytes" << std::endl;
+    }
+
+    if (optimize > 0)
+    {
+        GIF edited;
+        RecompressStats ostats;
+
+        edited.bytes.swap(out);
+
+        if (!parse_gif(edited))
+        {
+            return 1;
+        }
+
+        optimize_gif(edited, out, &ostats, optimize);
+
+        std::cerr << "optimize: " << ostats.frames_recompressed << " frames recompressed, image data "
+                  << ostats.bytes_before << " -> " << ostats.bytes_after << " bytes" << std::endl;
+    }
+
+    if (!write_file(argv[2], out))
+    {
+        return 1;
+    }
+
+    return 0;
+}
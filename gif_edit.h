@@ -0,0 +1,619 @@
+/*
+Editing GIFs in the compressed domain
+
+Frames that are kept as they are get their bytes (image descriptor, color table and LZW data)
+copied straight from the input file. Only when dropping frames changes what a frame is drawn on
+top of, that frame is re-encoded from the composited canvas of the original animation, and only
+the part of the screen the dropped frames and the frame itself cover.
+*/
+
+#ifndef GIF_EDIT_H
+#define GIF_EDIT_H
+
+#include "gif.h"
+#include "gif_canvas.h"
+#include "gif_encode.h"
+#include "gif_effects.h"
+
+struct EditOptions
+{
+    std::vector<bool> keep; // frames to keep, missing entries count as kept
+    int delay_time = -1; // new delay time of every frame in 1/100 s, -1 keeps the original ones
+    int loop_count = -2; // -2 keeps the NETSCAPE2.0 extension, -1 removes it, otherwise sets it
+    bool strip_comments = false;
+    bool strip_extensions = false; // application extensions except NETSCAPE2.0, plain text and unknown ones
+    std::vector<PaletteEffect> effects; // applied to the color tables
+    EffectScript script; // embedded for the player, replacing the file's own one unless empty
+};
+
+struct EditStats
+{
+    size_t frames_copied = 0;
+    size_t frames_reencoded = 0;
+    size_t frames_dropped = 0;
+    size_t frames_inserted = 0; // catching up with the original after dropped frames
+};
+
+inline bool is_netscape(const ApplicationExtension* ae)
+{
+    return std::memcmp(ae->appid, "NETSCAPE", 8) == 0 || std::memcmp(ae->appid, "ANIMEXTS", 8) == 0;
+}
+
+/* Copy the image block, replacing its color table (local or global) by a local one holding palette */
+inline void copy_image_with_palette(std::vector<uint8_t>& out, const GIF& gif, const Image* img, const std::vector<Color>& palette)
+{
+    const uint8_t* block = &gif.bytes[img->offset];
+
+    out.insert(out.end(), block, block + 9); // introducer, position and size
+    out.push_back((block[9] & 0x40) | 0x80 | color_table_size(palette.size())); // keep interlace, add the table
+    write_color_table(out, palette);
+    out.insert(out.end(), gif.bytes.begin() + img->data_offset - 1, gif.bytes.begin() + img->offset + img->length); // LZW data
+}
+
+/*
+Indices of n pixels into ct (a frame's own color table) followed by the colors ct doesn't have.
+False if that makes more than max_colors colors.
+*/
+inline bool extend_palette(const std::vector<Color>& ct, const uint32_t* pixels, size_t n, int max_colors,
+                           std::vector<Color>& palette, std::vector<uint8_t>& indices)
+{
+    std::unordered_map<uint32_t, uint8_t> exact;
+
+    palette.clear();
+    indices.resize(n);
+
+    for (auto& c : ct)
+    {
+        uint32_t rgb = (c.r << 16) | (c.g << 8) | c.b;
+
+        if (exact.find(rgb) == exact.end() && int(palette.size()) < max_colors)
+        {
+            exact.emplace(rgb, palette.size());
+            palette.push_back(c);
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint32_t rgb = pixels[i] & 0xFFFFFF;
+        auto it = exact.find(rgb);
+
+        if (it == exact.end())
+        {
+            if (int(palette.size()) == max_colors)
+            {
+                return false;
+            }
+
+            it = exact.emplace(rgb, palette.size()).first;
+            palette.push_back(Color{uint8_t(rgb >> 16), uint8_t(rgb >> 8), uint8_t(rgb)});
+        }
+
+        indices[i] = it->second;
+    }
+
+    return true;
+}
+
+/*
+Encode the rectangle r of pixels (a canvas width pixels wide) as a frame drawn over shown, what
+the output's canvas holds so far, and draw it onto shown. Pixels that are the same in both are
+transparent, the others use the colors of ct (the frame's own color table) plus those it doesn't
+have, or failing that only the colors that are used. With opaque, or when the transparent index is
+the one color too many, every pixel is written. If the colors need more than one color table,
+nothing is written and the result is false, unless reduce is set: then they're quantized, and
+shown only comes close to pixels.
+*/
+inline bool write_delta(std::vector<uint8_t>& out, const std::vector<uint32_t>& pixels, std::vector<uint32_t>& shown, size_t width,
+                        const Rect& r, const std::vector<Color>& ct, int delay_time, bool reduce, bool opaque = false)
+{
+    std::vector<uint32_t> changes; // pixels that differ from shown, row by row
+    std::vector<bool> same(size_t(r.width) * r.height);
+
+    for (int y = 0; y < r.height; ++y)
+    {
+        size_t row = size_t(r.top + y) * width + r.left;
+
+        for (int x = 0; x < r.width; ++x)
+        {
+            bool unchanged = !opaque && pixels[row + x] == shown[row + x];
+
+            same[size_t(y) * r.width + x] = unchanged;
+
+            if (!unchanged)
+            {
+                changes.push_back(pixels[row + x]);
+            }
+        }
+    }
+
+    bool transparent = changes.size() < same.size();
+    int max_colors = transparent ? 255 : 256; // one index left for transparency
+    std::vector<Color> palette;
+    std::vector<uint8_t> changed_indices;
+
+    if (!extend_palette(ct, changes.data(), changes.size(), max_colors, palette, changed_indices) &&
+        !extend_palette({}, changes.data(), changes.size(), max_colors, palette, changed_indices))
+    {
+        if (transparent && write_delta(out, pixels, shown, width, r, ct, delay_time, false, true))
+        {
+            return true;
+        }
+
+        if (!reduce)
+        {
+            return false;
+        }
+
+        quantize(changes.data(), changes.size(), max_colors, palette, changed_indices);
+    }
+
+    uint8_t trans_idx = 0;
+
+    if (transparent)
+    {
+        trans_idx = palette.size();
+        palette.push_back(Color{0, 0, 0});
+    }
+
+    std::vector<uint8_t> indices(same.size());
+    size_t k = 0;
+
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        indices[i] = same[i] ? trans_idx : changed_indices[k++];
+    }
+
+    if (transparent)
+    {
+        // unchanged pixels can also keep their own color if it's in the palette, see StreamEncoder::choose_transparency()
+        std::unordered_map<uint32_t, uint8_t> exact;
+        std::vector<uint8_t> alt = indices;
+
+        for (size_t i = 0; i < trans_idx; ++i)
+        {
+            exact.emplace((palette[i].r << 16) | (palette[i].g << 8) | palette[i].b, i);
+        }
+
+        for (int y = 0; y < r.height; ++y)
+        {
+            size_t row = size_t(r.top + y) * width + r.left;
+
+            for (int x = 0; x < r.width; ++x)
+            {
+                size_t i = size_t(y) * r.width + x;
+                auto it = same[i] ? exact.find(pixels[row + x] & 0xFFFFFF) : exact.end();
+
+                if (it != exact.end())
+                {
+                    alt[i] = it->second;
+                }
+            }
+        }
+
+        int lzw_min = lzw_min_code_size(palette.size());
+        std::vector<uint8_t> chosen = indices;
+
+        if (lzw_choose_indices(chosen.data(), alt.data(), chosen.size(), lzw_min) < lzw_choose_indices(indices.data(), nullptr, indices.size(), lzw_min))
+        {
+            indices.swap(chosen);
+        }
+    }
+
+    write_graphics_control(out, 1, delay_time, transparent, trans_idx);
+    write_image(out, r.left, r.top, r.width, r.height, palette, indices.data(), palette.size());
+
+    for (int y = 0; y < r.height; ++y)
+    {
+        for (int x = 0; x < r.width; ++x)
+        {
+            uint8_t index = indices[size_t(y) * r.width + x];
+
+            if (!transparent || index != trans_idx)
+            {
+                const Color& c = palette[index];
+                shown[size_t(r.top + y) * width + r.left + x] = color_rgba(c.r, c.g, c.b, 255);
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+Apply opt to gif and write the result to out. A kept frame is copied verbatim as long as the
+canvas it's drawn on is the same as in the original, which holds until frames get dropped.
+After a gap, a frame is still copied if it covers the whole screen with opaque pixels; otherwise
+it's re-encoded with write_delta() over the rectangles of the dropped frames and its own, the only
+place the two canvases can differ. That frame is in sync afterwards unless the original frame is
+disposed of (methods 2 and 3), in which case the next one covers its rectangle too.
+
+When the dropped frames and the kept one have more than 256 colors between them, the dropped
+frames' rectangles get a frame of their own and the kept frame is copied after it. That frame
+takes 2/100 s (the shortest delay browsers don't stretch to 1/10 s) of the kept frame's delay,
+or none if the delay is 0 anyway. Delays of 1 to 3 are too short to split, and the dropped frames
+alone can have too many colors as well; then the merged frame is quantized. Quantized pixels
+differ from the original, so the output stays out of sync there and the frames drawn over them
+are re-encoded too.
+
+Color effects only rewrite color tables. If they change over time, every frame gets a local
+color table of its own; like in the viewer, pixels only pick up the new colors when a frame
+draws over them.
+*/
+inline void edit_gif(const GIF& gif, const EditOptions& opt, std::vector<uint8_t>& out, EditStats* stats = nullptr)
+{
+    EditStats s;
+    Snapshots snapshots(gif, opt.effects);
+    bool vary = effects_vary(opt.effects);
+
+    // header, logical screen descriptor and global color table
+    size_t header_length = 13 + (gif.gct_flag ? 3 * gif.gct.size() : 0);
+
+    if (opt.effects.empty() || !gif.gct_flag)
+    {
+        copy_header(out, gif, header_length);
+    }
+    else
+    {
+        std::vector<Color> gct = gif.gct;
+        apply_palette_effects(opt.effects, 0, gct);
+
+        copy_header(out, gif, 13);
+        write_color_table(out, gct);
+    }
+
+    if (opt.loop_count >= 0 && gif.loop_count < 0)
+    {
+        write_netscape(out, opt.loop_count);
+    }
+
+    if (!opt.script.empty())
+    {
+        write_effect_script(out, opt.script);
+    }
+
+    const GIFBlock* gc = nullptr; // graphic control extension waiting for its image
+    size_t frame = 0;
+    Rect screen{0, 0, int(gif.canvas_width), int(gif.canvas_height)};
+    Rect changed{0, 0, 0, 0}; // where the output's canvas can differ from the original one, empty while in sync
+    size_t gap_start = 0; // first frame dropped since the output was last in sync
+    std::vector<uint32_t> shown; // output's canvas, taken from the original when a re-encoded frame needs it
+
+    for (auto& block : gif.blocks)
+    {
+        switch (block->type)
+        {
+        case BT_GRAPHIC_CONTROL:
+        {
+            gc = block.get();
+            break;
+        }
+        case BT_IMAGE:
+        {
+            const Frame& f = gif.frames[frame];
+            bool keep = frame >= opt.keep.size() || opt.keep[frame];
+            int delay_time = opt.delay_time >= 0 ? opt.delay_time : f.delay_time;
+
+            if (!keep)
+            {
+                if (changed.empty())
+                {
+                    gap_start = frame;
+                    shown.clear();
+                }
+
+                changed = bounding_rect(changed, intersect(frame_rect(f), screen));
+                s.frames_dropped++;
+            }
+            else
+            {
+                bool copy = changed.empty() || (covers_canvas(gif, f) && !f.transparent && f.disposal_method != 3);
+
+                if (!copy)
+                {
+                    if (shown.empty())
+                    {
+                        shown = snapshots.before(gap_start).pixels;
+                    }
+
+                    std::vector<Color> ct = f.image->ct;
+
+                    if (!opt.effects.empty())
+                    {
+                        apply_palette_effects(opt.effects, effect_progress(gif, f), ct);
+                    }
+
+                    std::vector<uint32_t> under = snapshots.before(frame).pixels;
+                    const Canvas& canvas = snapshots.at(frame);
+                    Rect r = bounding_rect(changed, intersect(frame_rect(f), screen));
+
+                    bool merged = write_delta(out, canvas.pixels, shown, canvas.width(), r, ct, delay_time, false);
+                    int catch_up = delay_time == 0 ? 0 : 2;
+
+                    if (!merged && (delay_time == 0 || delay_time >= 4) &&
+                        write_delta(out, under, shown, canvas.width(), changed, {}, catch_up, false))
+                    {
+                        // caught up with the original, the frame fits on top of it as it is
+                        delay_time -= catch_up;
+                        copy = true;
+                        s.frames_inserted++;
+                    }
+                    else
+                    {
+                        if (!merged)
+                        {
+                            write_delta(out, canvas.pixels, shown, canvas.width(), r, ct, delay_time, true);
+                        }
+
+                        // quantized pixels keep the output out of sync where they are
+                        Rect differs = shown == canvas.pixels ? Rect{0, 0, 0, 0} : r;
+                        changed = bounding_rect(differs, f.disposal_method <= 1 ? Rect{0, 0, 0, 0} : intersect(frame_rect(f), screen));
+                        s.frames_reencoded++;
+                    }
+                }
+
+                if (copy)
+                {
+                    if (gc != nullptr && delay_time == f.delay_time)
+                    {
+                        copy_block(out, gif, gc);
+                    }
+                    else if (gc != nullptr || delay_time != 0)
+                    {
+                        write_graphics_control(out, f.disposal_method, delay_time, f.transparent, f.trans_idx);
+                    }
+
+                    if (!opt.effects.empty() && (vary || f.image->local_ct))
+                    {
+                        std::vector<Color> ct = f.image->ct;
+                        apply_palette_effects(opt.effects, effect_progress(gif, f), ct);
+                        copy_image_with_palette(out, gif, f.image, ct);
+                    }
+                    else
+                    {
+                        copy_block(out, gif, block.get());
+                    }
+
+                    changed = Rect{0, 0, 0, 0};
+                    s.frames_copied++;
+                }
+            }
+
+            gc = nullptr;
+            frame++;
+            break;
+        }
+        case BT_APPLICATION_EXTENSION:
+        {
+            const ApplicationExtension* ae = dynamic_cast<const ApplicationExtension*>(block.get());
+
+            if (is_netscape(ae))
+            {
+                if (opt.loop_count == -2)
+                {
+                    copy_block(out, gif, ae);
+                }
+                else if (opt.loop_count >= 0)
+                {
+                    write_netscape(out, opt.loop_count);
+                }
+            }
+            else if (!opt.strip_extensions && !(is_effect_script(ae) && !opt.script.empty()))
+            {
+                copy_block(out, gif, ae);
+            }
+            break;
+        }
+        case BT_COMMENT_BLOCK:
+        {
+            if (!opt.strip_comments)
+            {
+                copy_block(out, gif, block.get());
+            }
+            break;
+        }
+        case BT_OTHER_EXTENSION:
+        {
+            if (is_plain_text(block.get()))
+            {
+                if (gc != nullptr && !opt.strip_extensions)
+                {
+                    copy_block(out, gif, gc);
+                }
+
+                gc = nullptr;
+            }
+
+            if (!opt.strip_extensions)
+            {
+                copy_block(out, gif, block.get());
+            }
+            break;
+        }
+        }
+    }
+
+    out.push_back(0x3B); // trailer
+
+    if (stats != nullptr)
+    {
+        *stats = s;
+    }
+}
+
+struct ConcatStats
+{
+    size_t frames_copied = 0;
+    size_t tables_converted = 0; // frames whose file's global color table became a local one
+    size_t frames_inserted = 0; // frames clearing the canvas between two files
+};
+
+/*
+Splice the animations of gifs one after another, reusing every frame's compressed data. The
+output uses the logical screen size of the largest file and the global color table, background
+color and loop count of the first one; frames of the other files that rely on their file's global
+color table get it as a local color table. At each seam the canvas is cleared to the background
+so that the next file starts out the same way it would on its own: through disposal method 2 on
+the previous frame if that frame covers everything its file drew, otherwise with an inserted
+transparent frame over that area and disposal method 2. The inserted frame shows the same as the
+previous one, so it takes 2/100 s of that frame's delay (the shortest delay browsers don't
+stretch to 1/10 s) and the seam keeps its timing; only a delay under 4 is left as it is and the
+seam gets the browser's minimum on top. Nothing is needed when the next file starts with an
+opaque full screen frame.
+*/
+inline void concat_gifs(const std::vector<const GIF*>& gifs, std::vector<uint8_t>& out, ConcatStats* stats = nullptr)
+{
+    ConcatStats s;
+
+    if (gifs.empty())
+    {
+        return;
+    }
+
+    const GIF& head = *gifs[0];
+    size_t width = 0;
+    size_t height = 0;
+
+    for (const GIF* gif : gifs)
+    {
+        width = std::max(width, gif->canvas_width);
+        height = std::max(height, gif->canvas_height);
+    }
+
+    // header and global color table of the first file with the new screen size
+    size_t header_length = 13 + (head.gct_flag ? 3 * head.gct.size() : 0);
+    size_t start = out.size();
+
+    copy_header(out, head, header_length);
+    out[start + 6] = width & 0xFF;
+    out[start + 7] = (width >> 8) & 0xFF;
+    out[start + 8] = height & 0xFF;
+    out[start + 9] = (height >> 8) & 0xFF;
+
+    size_t total = 0;
+
+    for (const GIF* gif : gifs)
+    {
+        total += gif->bytes.size();
+    }
+
+    out.reserve(out.size() + total + total / 16); // room for the converted color tables
+
+    GIF screen; // only describes the output's logical screen for covers_canvas()
+    screen.canvas_width = width;
+    screen.canvas_height = height;
+
+    for (size_t j = 0; j < gifs.size(); ++j)
+    {
+        const GIF& gif = *gifs[j];
+        bool same_gct = gif.gct_flag && head.gct_flag && std::equal(gif.bytes.begin() + 13, gif.bytes.begin() + 13 + 3 * gif.gct.size(),
+                                                                    head.bytes.begin() + 13, head.bytes.begin() + header_length);
+        const GIFBlock* gc = nullptr;
+        size_t frame = 0;
+        Rect drawn{0, 0, 0, 0}; // what the frames of gif can have drawn on the screen
+
+        for (auto& f : gif.frames)
+        {
+            drawn = bounding_rect(drawn, intersect(frame_rect(f), Rect{0, 0, int(width), int(height)}));
+        }
+
+        for (auto& block : gif.blocks)
+        {
+            if (block->type == BT_GRAPHIC_CONTROL)
+            {
+                gc = block.get();
+                continue;
+            }
+
+            if (block->type == BT_APPLICATION_EXTENSION)
+            {
+                if (j == 0 || !is_netscape(dynamic_cast<const ApplicationExtension*>(block.get())))
+                {
+                    copy_block(out, gif, block.get());
+                }
+                continue;
+            }
+
+            if (block->type == BT_COMMENT_BLOCK || block->type == BT_OTHER_EXTENSION)
+            {
+                if (is_plain_text(block.get()) && gc != nullptr)
+                {
+                    copy_block(out, gif, gc);
+                    gc = nullptr;
+                }
+
+                copy_block(out, gif, block.get());
+                continue;
+            }
+
+            const Frame& f = gif.frames[frame];
+            bool clears = false; // the screen has to be cleared after this frame
+            bool disposes = false; // by disposal method 2 on this frame
+            int delay_time = f.delay_time;
+            int clear_delay = 0; // of the inserted frame
+
+            if (j + 1 < gifs.size() && frame + 1 == gif.frames.size() && !drawn.empty())
+            {
+                const GIF& next = *gifs[j + 1];
+                const Frame* first = next.frames.empty() ? nullptr : &next.frames[0];
+                Rect r = intersect(frame_rect(f), drawn);
+
+                clears = !(first != nullptr && covers_canvas(screen, *first) && !first->transparent && first->disposal_method != 3);
+                disposes = r.left == drawn.left && r.top == drawn.top && r.width == drawn.width && r.height == drawn.height;
+
+                if (clears && !disposes && delay_time >= 4)
+                {
+                    clear_delay = 2;
+                    delay_time -= clear_delay;
+                }
+            }
+
+            if (clears && disposes)
+            {
+                write_graphics_control(out, 2, delay_time, f.transparent, f.trans_idx);
+            }
+            else if (delay_time != f.delay_time)
+            {
+                write_graphics_control(out, f.disposal_method, delay_time, f.transparent, f.trans_idx);
+            }
+            else if (gc != nullptr)
+            {
+                copy_block(out, gif, gc);
+            }
+
+            if (j > 0 && !same_gct && !f.image->local_ct && gif.gct_flag)
+            {
+                copy_image_with_palette(out, gif, f.image, gif.gct);
+                s.tables_converted++;
+            }
+            else
+            {
+                copy_block(out, gif, f.image);
+            }
+
+            s.frames_copied++;
+
+            if (clears && !disposes)
+            {
+                std::vector<uint8_t> blank(size_t(drawn.width) * drawn.height, 0);
+                std::vector<Color> lct(2, Color{0, 0, 0});
+
+                write_graphics_control(out, 2, clear_delay, true, 0);
+                write_image(out, drawn.left, drawn.top, drawn.width, drawn.height, lct, blank.data(), lct.size());
+                s.frames_inserted++;
+            }
+
+            gc = nullptr;
+            frame++;
+        }
+    }
+
+    out.push_back(0x3B); // trailer
+
+    if (stats != nullptr)
+    {
+        *stats = s;
+    }
+}
+
+#endif
@@ -0,0 +1,419 @@
+/*
+Special effects
+
+Color effects are applied to the (at most 256 entry) color tables instead of to the pixels, so
+they cost the same for every frame no matter how big it is.
+
+An animation can also carry its own playback effects in a private application extension (see
+EffectScript) that our player applies when it shows the file.
+*/
+
+#ifndef GIF_EFFECTS_H
+#define GIF_EFFECTS_H
+
+#include "gif.h"
+
+#include <cmath>
+#include <algorithm>
+
+typedef enum EffectType
+{
+    FX_GRAYSCALE = 0,
+    FX_SEPIA,
+    FX_HUE,
+    FX_BRIGHTNESS,
+    FX_CONTRAST,
+    FX_INVERT,
+    FX_FADE
+} EffectType;
+
+const std::string effect_type_str[7] = {
+    "grayscale",
+    "sepia",
+    "hue",
+    "brightness",
+    "contrast",
+    "invert",
+    "fade"
+};
+
+/*
+A color effect whose strength goes linearly from `from` at the start of the animation to `to`
+at its end. What the strength means depends on the effect:
+- grayscale, sepia, invert, fade: how much of the effect is mixed in (0 - 1)
+- hue: rotation in degrees
+- brightness: added to every channel (-1 - 1)
+- contrast: factor around mid gray (1 = unchanged)
+*/
+struct PaletteEffect
+{
+    EffectType type;
+    float from;
+    float to;
+    Color color; // fade target
+};
+
+/* v rounded to 0 - 255; NaN (e.g. a hue rotation by an infinite angle) gives 0 */
+inline uint8_t clamp_channel(float v)
+{
+    return !(v > 0) ? 0 : v >= 255 ? 255 : uint8_t(v + 0.5f);
+}
+
+inline Color mix(const Color& a, float ar, float ag, float ab, float amount)
+{
+    return Color{clamp_channel(a.r + (ar - a.r) * amount),
+                 clamp_channel(a.g + (ag - a.g) * amount),
+                 clamp_channel(a.b + (ab - a.b) * amount)};
+}
+
+inline Color apply_effect(const PaletteEffect& fx, float amount, const Color& c)
+{
+    switch (fx.type)
+    {
+    case FX_GRAYSCALE:
+    {
+        float y = 0.299f * c.r + 0.587f * c.g + 0.114f * c.b;
+        return mix(c, y, y, y, amount);
+    }
+    case FX_SEPIA:
+    {
+        return mix(c, 0.393f * c.r + 0.769f * c.g + 0.189f * c.b,
+                      0.349f * c.r + 0.686f * c.g + 0.168f * c.b,
+                      0.272f * c.r + 0.534f * c.g + 0.131f * c.b, amount);
+    }
+    case FX_HUE:
+    {
+        // rotation around the gray axis
+        float a = amount * 3.14159265f / 180;
+        float cosa = std::cos(a);
+        float sina = std::sin(a);
+        float k = (1 - cosa) / 3;
+        float s = std::sqrt(1.0f / 3) * sina;
+
+        return Color{clamp_channel(c.r * (cosa + k) + c.g * (k - s) + c.b * (k + s)),
+                     clamp_channel(c.r * (k + s) + c.g * (cosa + k) + c.b * (k - s)),
+                     clamp_channel(c.r * (k - s) + c.g * (k + s) + c.b * (cosa + k))};
+    }
+    case FX_BRIGHTNESS:
+    {
+        float d = amount * 255;
+        return Color{clamp_channel(c.r + d), clamp_channel(c.g + d), clamp_channel(c.b + d)};
+    }
+    case FX_CONTRAST:
+    {
+        return Color{clamp_channel((c.r - 128) * amount + 128),
+                     clamp_channel((c.g - 128) * amount + 128),
+                     clamp_channel((c.b - 128) * amount + 128)};
+    }
+    case FX_INVERT:
+    {
+        return mix(c, 255 - c.r, 255 - c.g, 255 - c.b, amount);
+    }
+    case FX_FADE:
+    {
+        return mix(c, fx.color.r, fx.color.g, fx.color.b, amount);
+    }
+    }
+
+    return c;
+}
+
+/* Apply effects to a color table at position t (0 - 1) of the animation */
+inline void apply_palette_effects(const std::vector<PaletteEffect>& effects, float t, std::vector<Color>& ct)
+{
+    for (auto& fx : effects)
+    {
+        float amount = fx.from + (fx.to - fx.from) * t;
+
+        for (auto& c : ct)
+        {
+            c = apply_effect(fx, amount, c);
+        }
+    }
+}
+
+/* Whether the result of the effects changes over the course of the animation */
+inline bool effects_vary(const std::vector<PaletteEffect>& effects)
+{
+    for (auto& fx : effects)
+    {
+        if (fx.from != fx.to)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Position of frame f (one of gif.frames) in the animation (0 - 1) for time varying effects */
+inline float effect_progress(const GIF& gif, const Frame& f)
+{
+    if (gif.frames.size() <= 1)
+    {
+        return 0;
+    }
+
+    const Frame& last = gif.frames.back();
+
+    if (last.start_time > 0)
+    {
+        return float(f.start_time) / last.start_time;
+    }
+
+    return float(&f - gif.frames.data()) / (gif.frames.size() - 1); // no delay times, go by frame number
+}
+
+/*
+Parse NAME[:FROM[-TO]][:RRGGBB], e.g. "grayscale", "hue:0-360", "fade:0-1:ffffff".
+Returns false for unknown effects and malformed numbers or colors.
+*/
+inline bool parse_effect(const std::string& spec, PaletteEffect& fx)
+{
+    std::vector<std::string> parts;
+    std::stringstream ss(spec);
+    std::string part;
+
+    while (std::getline(ss, part, ':'))
+    {
+        parts.push_back(part);
+    }
+
+    if (parts.empty())
+    {
+        return false;
+    }
+
+    auto type = std::find(effect_type_str, effect_type_str + 7, parts[0]);
+
+    if (type == effect_type_str + 7)
+    {
+        return false;
+    }
+
+    fx.type = EffectType(type - effect_type_str);
+    fx.from = fx.to = fx.type == FX_HUE ? 180 : fx.type == FX_BRIGHTNESS ? 0.2f : fx.type == FX_CONTRAST ? 1.5f : 1;
+    fx.color = Color{0, 0, 0};
+
+    if (parts.size() > 1 && !parts[1].empty())
+    {
+        size_t dash = parts[1].find('-', 1); // a leading '-' is a sign
+
+        if (!parse_float(parts[1].substr(0, dash), fx.from))
+        {
+            return false;
+        }
+
+        if (dash == std::string::npos)
+        {
+            fx.to = fx.from;
+        }
+        else if (!parse_float(parts[1].substr(dash + 1), fx.to))
+        {
+            return false;
+        }
+    }
+
+    return parts.size() <= 2 || (parts.size() == 3 && parse_rgb(parts[2], fx.color));
+}
+
+/* Rotate count color table entries starting at first by one position every step centiseconds */
+struct PaletteCycle
+{
+    uint8_t first;
+    uint8_t count;
+    int step;
+};
+
+inline void apply_palette_cycles(const std::vector<PaletteCycle>& cycles, int time, std::vector<Color>& ct)
+{
+    for (auto& cycle : cycles)
+    {
+        size_t end = std::min<size_t>(cycle.first + cycle.count, ct.size());
+
+        if (size_t(cycle.first) + 1 >= end || cycle.step <= 0)
+        {
+            continue;
+        }
+
+        size_t shift = size_t(time / cycle.step) % (end - cycle.first);
+        std::rotate(ct.begin() + cycle.first, ct.begin() + end - shift, ct.begin() + end);
+    }
+}
+
+/*
+Playback effects stored in a "MYGIF_FX1.0" application extension. Its data is a version byte (1)
+followed by records, each starting with a tag byte:
+- 1 palette effect: type, from and to (float, little-endian), fade color (r, g, b)
+- 2 palette cycle: first entry, number of entries, step (u16, in 1/100 s)
+- 3 speed ramp: speed at the start and at the end of the animation (u16 each, in percent)
+- 4 ping-pong: play forward, then backward
+Unknown tags end the script, so newer records can be added at the end. Everything is evaluated on
+color tables, delay times and the order of the frames; none of it touches pixels.
+*/
+struct EffectScript
+{
+    std::vector<PaletteEffect> effects;
+    std::vector<PaletteCycle> cycles;
+    int speed_from = 100;
+    int speed_to = 100;
+    bool ping_pong = false;
+
+    bool empty() const
+    {
+        return effects.empty() && cycles.empty() && speed_from == 100 && speed_to == 100 && !ping_pong;
+    }
+};
+
+const char effect_script_appid[] = "MYGIF_FX1.0";
+
+inline bool is_effect_script(const ApplicationExtension* ae)
+{
+    return std::memcmp(ae->appid, effect_script_appid, 8) == 0 && std::memcmp(ae->authcode, effect_script_appid + 8, 3) == 0;
+}
+
+/* A delay time of frame f (one of gif.frames) after the speed ramp */
+inline int scaled_delay(const EffectScript& script, const GIF& gif, const Frame& f, int delay_time)
+{
+    float t = effect_progress(gif, f);
+    float speed = script.speed_from + (script.speed_to - script.speed_from) * t;
+
+    return speed > 0 ? int(delay_time * 100 / speed + 0.5f) : delay_time;
+}
+
+/* Parse the data of an effect script extension; returns false if it's not a version we know or holds infinite or NaN strengths */
+inline bool parse_effect_script(const uint8_t* data, size_t nbytes, EffectScript& script)
+{
+    if (nbytes < 1 || data[0] != 1)
+    {
+        return false;
+    }
+
+    auto u16 = [&](size_t i) { return data[i] | (data[i + 1] << 8); };
+    auto f32 = [&](size_t i)
+    {
+        uint32_t bits = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) | (uint32_t(data[i + 3]) << 24);
+        float v;
+        std::memcpy(&v, &bits, 4);
+        return v;
+    };
+
+    size_t idx = 1;
+
+    while (idx < nbytes)
+    {
+        uint8_t tag = data[idx++];
+
+        if (tag == 1 && idx + 12 <= nbytes && data[idx] < 7)
+        {
+            if (!std::isfinite(f32(idx + 1)) || !std::isfinite(f32(idx + 5)))
+            {
+                return false;
+            }
+
+            script.effects.push_back(PaletteEffect{EffectType(data[idx]), f32(idx + 1), f32(idx + 5), Color{data[idx + 9], data[idx + 10], data[idx + 11]}});
+            idx += 12;
+        }
+        else if (tag == 2 && idx + 4 <= nbytes)
+        {
+            script.cycles.push_back(PaletteCycle{data[idx], data[idx + 1], u16(idx + 2)});
+            idx += 4;
+        }
+        else if (tag == 3 && idx + 4 <= nbytes)
+        {
+            script.speed_from = u16(idx);
+            script.speed_to = u16(idx + 2);
+            idx += 4;
+        }
+        else if (tag == 4)
+        {
+            script.ping_pong = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return true;
+}
+
+/* Collect the effect scripts of a parsed GIF; returns false if it has none */
+inline bool read_effect_script(const GIF& gif, EffectScript& script)
+{
+    bool found = false;
+
+    for (auto& block : gif.blocks)
+    {
+        if (block->type == BT_APPLICATION_EXTENSION)
+        {
+            const ApplicationExtension* ae = dynamic_cast<const ApplicationExtension*>(block.get());
+
+            if (is_effect_script(ae) && parse_effect_script(ae->data.data(), ae->data.size(), script))
+            {
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+/* Append script as a complete application extension block */
+inline void write_effect_script(std::vector<uint8_t>& out, const EffectScript& script)
+{
+    std::vector<uint8_t> data{1};
+
+    auto u16 = [&](int v) { data.push_back(v & 0xFF); data.push_back((v >> 8) & 0xFF); };
+    auto f32 = [&](float v)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &v, 4);
+
+        for (int i = 0; i < 4; ++i)
+        {
+            data.push_back((bits >> (8 * i)) & 0xFF);
+        }
+    };
+
+    for (auto& fx : script.effects)
+    {
+        data.push_back(1);
+        data.push_back(fx.type);
+        f32(fx.from);
+        f32(fx.to);
+        data.insert(data.end(), {fx.color.r, fx.color.g, fx.color.b});
+    }
+
+    for (auto& cycle : script.cycles)
+    {
+        data.insert(data.end(), {2, cycle.first, cycle.count});
+        u16(cycle.step);
+    }
+
+    if (script.speed_from != 100 || script.speed_to != 100)
+    {
+        data.push_back(3);
+        u16(script.speed_from);
+        u16(script.speed_to);
+    }
+
+    if (script.ping_pong)
+    {
+        data.push_back(4);
+    }
+
+    out.insert(out.end(), {0x21, 0xFF, 11});
+    out.insert(out.end(), effect_script_appid, effect_script_appid + 11);
+
+    for (size_t i = 0; i < data.size(); i += 255)
+    {
+        size_t n = std::min<size_t>(255, data.size() - i);
+        out.push_back(n);
+        out.insert(out.end(), data.begin() + i, data.begin() + i + n);
+    }
+
+    out.push_back(0); // block terminator
+}
+
+#endif
@@ -0,0 +1,207 @@
+/*
+encode frames read from standard input into a GIF
+
+to compile: g++ gif_encode.cpp -o gif_encode -std=c++14 -O2 -pthread
+usage: gif_encode [OPTIONS] < INPUT > OUTPUT.gif
+
+input: raw RGBA ("RGBA WIDTH HEIGHT" on a line, then the frames), PAM or YUV4MPEG2, e.g.
+  ffmpeg -i clip.mp4 -f yuv4mpegpipe - | gif_encode -o clip.gif
+
+options:
+  -o FILE               write to FILE instead of standard output
+  --delay CS            delay time of every frame in 1/100 s (from the frame rate for YUV4MPEG2, else 4)
+  --loop N|none         loop count (0 = forever, the default) or no loop extension
+  --lossy[=N]           lossy LZW, see gif_edit (20 by default)
+  --optimize[=N]        optimal clear code placement, see gif_edit (128 by default)
+  --single-thread       don't run reading, LZW and writing on threads of their own
+  --target-size BYTES   make the file at most BYTES big by going down a ladder of palette sizes and
+                        lossy levels, then resolutions, then frame rates (holds all frames in memory
+                        and runs on one thread); --lossy=N is the lowest lossy level it tries and
+                        --optimize applies to the encodes without lossy LZW
+
+Reading, quantization, LZW compression and writing run on four threads connected by queues of a
+few frames each.
+*/
+
+#include "gif.h"
+#include "gif_input.h"
+#include "gif_ratecontrol.h"
+#include "gif_stream.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+/* Read every frame, then encode at the best quality that fits in target_size bytes (lossy is the lowest lossy level) */
+bool encode_to_size(FrameReader& reader, std::ostream& out, int delay_time, int loop_count, size_t target_size, int lossy, size_t optimize)
+{
+    std::vector<std::vector<uint32_t>> frames;
+    std::vector<uint32_t> pixels;
+
+    while (reader.read(pixels))
+    {
+        frames.push_back(pixels);
+    }
+
+    std::vector<int> delays(frames.size(), delay_time);
+    RateControl rate(frames, delays, reader.width, reader.height, loop_count);
+    rate.min_lossy = lossy;
+    rate.optimize = optimize;
+    RateStats stats;
+    std::string bytes;
+
+    bool fits = rate.encode(target_size, bytes, &stats);
+    const RateLevel& r = rate_levels[stats.level];
+
+    out.write(bytes.data(), bytes.size());
+
+    if (!out)
+    {
+        std::cerr << "Couldn't write GIF file" << std::endl;
+        return false;
+    }
+
+    std::cerr << frames.size() << " frames read, " << bytes.size() << " bytes at 1/" << r.scale << " size, every "
+              << r.step << ". frame, " << r.colors << " colors, lossy " << stats.lossy << " ("
+              << stats.encodes << " encodes, " << stats.prepares << " quantized)" << std::endl;
+
+    if (!fits)
+    {
+        std::cerr << "Couldn't get below " << target_size << " bytes" << std::endl;
+    }
+
+    return fits;
+}
+
+int main(int argc, char *argv[])
+{
+    const char* path = nullptr;
+    int delay_time = 0; // 0 to take it from the input
+    int loop_count = 0;
+    int lossy = 0;
+    size_t optimize = 0;
+    bool threads = true;
+    size_t target_size = 0; // 0 without --target-size
+
+    for (int a = 1; a < argc; ++a)
+    {
+        std::string arg = argv[a];
+
+        if (arg == "-o" && a + 1 < argc)
+        {
+            path = argv[++a];
+        }
+        else if (arg == "--delay" && a + 1 < argc)
+        {
+            if (std::sscanf(argv[++a], "%d", &delay_time) != 1 || delay_time < 0 || delay_time > 65535)
+            {
+                std::cerr << "Bad delay time: " << argv[a] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--loop" && a + 1 < argc)
+        {
+            std::string loop = argv[++a];
+
+            if (loop == "none")
+            {
+                loop_count = -1;
+            }
+            else if (std::sscanf(loop.c_str(), "%d", &loop_count) != 1 || loop_count < 0 || loop_count > 65535)
+            {
+                std::cerr << "Bad loop count: " << loop << std::endl;
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 7, "--lossy") == 0)
+        {
+            lossy = 20;
+
+            if (arg.size() > 7 && (arg[7] != '=' || std::sscanf(arg.c_str() + 8, "%d", &lossy) != 1 || lossy <= 0 || lossy > 255))
+            {
+                std::cerr << "Bad lossy level: " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (arg.compare(0, 10, "--optimize") == 0)
+        {
+            optimize = 128;
+
+            if (arg.size() > 10 && (arg[10] != '=' || std::sscanf(arg.c_str() + 11, "%zu", &optimize) != 1 || optimize == 0))
+            {
+                std::cerr << "Bad number of candidates: " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--target-size" && a + 1 < argc)
+        {
+            const char* value = argv[++a];
+            char* end = nullptr;
+
+            target_size = std::strtoull(value, &end, 10);
+
+            if (value[0] < '0' || value[0] > '9' || *end != '\0' || target_size == 0)
+            {
+                std::cerr << "Bad target size: " << argv[a] << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--single-thread")
+        {
+            threads = false;
+        }
+        else
+        {
+            std::cerr << "Usage: gif_encode [-o FILE] [--delay CS] [--loop N|none] [--lossy[=N]] [--optimize[=N]] [--single-thread] [--target-size BYTES] < INPUT" << std::endl;
+            return 1;
+        }
+    }
+
+    std::ios::sync_with_stdio(false);
+
+    FrameReader reader(std::cin);
+
+    if (!reader.open())
+    {
+        return 1;
+    }
+
+    if (delay_time == 0)
+    {
+        delay_time = reader.delay_time > 0 ? reader.delay_time : 4;
+    }
+
+    std::ofstream file;
+
+    if (path != nullptr)
+    {
+        file.open(path, std::ios::binary);
+    }
+
+    std::ostream& out = path != nullptr ? static_cast<std::ostream&>(file) : std::cout;
+
+    if (target_size > 0)
+    {
+        return encode_to_size(reader, out, delay_time, loop_count, target_size, lossy, optimize) ? 0 : 1;
+    }
+
+    StreamEncoder encoder(out, reader.width, reader.height, loop_count);
+
+    encoder.lossy = lossy;
+    encoder.optimize = optimize;
+
+    bool ok = encode_frames(reader, encoder, delay_time, threads);
+
+    ok = encoder.finish() && ok;
+
+    if (!ok)
+    {
+        std::cerr << "Couldn't write GIF file: " << (path != nullptr ? path : "standard output") << std::endl;
+        return 1;
+    }
+
+    std::cerr << encoder.stats.frames_pushed << " frames read, " << encoder.stats.frames_written << " written, "
+              << encoder.stats.bytes_written << " bytes" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,674 @@
+/*
+GIF encoder: block writers, LZW encoder and color quantization
+
+Everything writes into a std::vector<uint8_t> holding the output file.
+*/
+
+#ifndef GIF_ENCODE_H
+#define GIF_ENCODE_H
+
+#include "gif.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+inline void put_u16(std::vector<uint8_t>& out, int v)
+{
+    out.push_back(v & 0xFF); // little-endian like everything else in a GIF
+    out.push_back((v >> 8) & 0xFF);
+}
+
+/* Size field of a color table with n entries (the table holds 2^(size+1) colors) */
+inline int color_table_size(size_t n)
+{
+    int size = 0;
+
+    while ((size_t(2) << size) < n && size < 7)
+    {
+        size++;
+    }
+
+    return size;
+}
+
+/* Write ct padded with black up to the next power of two */
+inline void write_color_table(std::vector<uint8_t>& out, const std::vector<Color>& ct)
+{
+    size_t ncolors = size_t(2) << color_table_size(ct.size());
+
+    for (size_t i = 0; i < ncolors; ++i)
+    {
+        Color c = i < ct.size() ? ct[i] : Color{0, 0, 0};
+        out.push_back(c.r);
+        out.push_back(c.g);
+        out.push_back(c.b);
+    }
+}
+
+/* Header and logical screen descriptor, followed by the global color table if gct isn't empty */
+inline void write_header(std::vector<uint8_t>& out, size_t width, size_t height, const std::vector<Color>& gct, int bkgd_color_idx = 0)
+{
+    const uint8_t signature[] = {'G', 'I', 'F', '8', '9', 'a'};
+    out.insert(out.end(), signature, signature + sizeof(signature));
+
+    put_u16(out, width);
+    put_u16(out, height);
+
+    int size = color_table_size(gct.size());
+    out.push_back((gct.empty() ? 0 : 0x80) | (7 << 4) | size);
+    out.push_back(bkgd_color_idx);
+    out.push_back(0); // pixel aspect ratio
+
+    if (!gct.empty())
+    {
+        write_color_table(out, gct);
+    }
+}
+
+inline void write_netscape(std::vector<uint8_t>& out, int loop_count)
+{
+    const uint8_t ext[] = {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01};
+    out.insert(out.end(), ext, ext + sizeof(ext));
+    put_u16(out, loop_count);
+    out.push_back(0);
+}
+
+inline void write_graphics_control(std::vector<uint8_t>& out, int disposal_method, int delay_time, bool transparent, uint8_t trans_idx)
+{
+    out.push_back(0x21);
+    out.push_back(0xF9);
+    out.push_back(4); // block size
+    out.push_back(((disposal_method & 7) << 2) | (transparent ? 1 : 0));
+    put_u16(out, delay_time);
+    out.push_back(trans_idx);
+    out.push_back(0); // terminator
+}
+
+inline void write_comment(std::vector<uint8_t>& out, const std::string& comment)
+{
+    out.push_back(0x21);
+    out.push_back(0xFE);
+
+    for (size_t i = 0; i < comment.size(); i += 255)
+    {
+        size_t n = std::min<size_t>(255, comment.size() - i);
+        out.push_back(n);
+        out.insert(out.end(), comment.begin() + i, comment.begin() + i + n);
+    }
+
+    out.push_back(0);
+}
+
+/* Image descriptor; the local color table follows if lct isn't empty */
+inline void write_image_descriptor(std::vector<uint8_t>& out, int left, int top, size_t width, size_t height, const std::vector<Color>& lct, bool interlace = false)
+{
+    out.push_back(0x2C);
+    put_u16(out, left);
+    put_u16(out, top);
+    put_u16(out, width);
+    put_u16(out, height);
+    out.push_back((lct.empty() ? 0 : 0x80) | (interlace ? 0x40 : 0) | color_table_size(lct.size()));
+
+    if (!lct.empty())
+    {
+        write_color_table(out, lct);
+    }
+}
+
+/* Smallest LZW minimum code size for a color table with n entries (the format wants at least 2) */
+inline int lzw_min_code_size(size_t n)
+{
+    return std::max(2, color_table_size(n) + 1);
+}
+
+/* String table of the LZW encoder: the code of each (prefix code, next index) string */
+class LZWTable
+{
+public:
+    LZWTable() : keys(hash_size, -1), codes(hash_size) {}
+
+    void clear() { std::fill(keys.begin(), keys.end(), -1); }
+
+    /* Code of the string prefix + k, or -1 with slot set to where it goes */
+    int find(int prefix, int k, size_t& slot) const
+    {
+        int32_t key = (prefix << 8) | k;
+        size_t h = (uint32_t(key) * 2654435761u) >> 19; // top 13 bits
+
+        while (keys[h] != -1 && keys[h] != key)
+        {
+            h = (h + 1) & (hash_size - 1);
+        }
+
+        slot = h;
+        return keys[h] == key ? codes[h] : -1;
+    }
+
+    void insert(size_t slot, int prefix, int k, int code)
+    {
+        keys[slot] = (prefix << 8) | k;
+        codes[slot] = code;
+    }
+
+private:
+    static const int hash_size = 8192; // more than 4096 codes so that the table never fills up
+
+    std::vector<int32_t> keys; // (prefix << 8) | index
+    std::vector<uint16_t> codes;
+};
+
+/*
+Code stream of the LZW encoder. The decoder adds a table entry for every code it reads, the
+writer mirrors that to know the code size. Codes collect in a 64-bit accumulator that is written
+out 8 bytes at a time, straight into the image data: the length byte of each sub-block is
+reserved in out before its bytes and filled in once it has 255 of them, so nothing is copied
+again to split it up.
+*/
+class LZWWriter
+{
+public:
+    /* Appends the minimum code size and the image data to out */
+    LZWWriter(int lzw_min_, std::vector<uint8_t>& out_) : lzw_min(lzw_min_), clear_code(1 << lzw_min_), eoi_code(clear_code + 1), out(out_)
+    {
+        out.push_back(lzw_min);
+        block = out.size();
+        out.push_back(0);
+
+        reset();
+        write(clear_code);
+    }
+
+    void write(int code)
+    {
+        if (nbits + code_size < 64)
+        {
+            acc |= uint64_t(code) << nbits;
+            nbits += code_size;
+            return;
+        }
+
+        // the accumulator is full: write 8 bytes, the bits of code that didn't fit stay
+        int rest = nbits + code_size - 64;
+
+        put8(acc | uint64_t(code) << nbits);
+        acc = rest > 0 ? uint64_t(code) >> (code_size - rest) : 0;
+        nbits = rest;
+    }
+
+    void add_entry()
+    {
+        if (next_code < 0x1000)
+        {
+            next_code++;
+
+            if (next_code > (1 << code_size) && code_size < 12)
+            {
+                code_size++;
+            }
+        }
+    }
+
+    /* Code the next table entry gets, 0x1000 if the table is full */
+    int next() const { return next_code; }
+
+    /* Write a clear code, the caller empties its string table */
+    void clear()
+    {
+        write(clear_code);
+        reset();
+    }
+
+    /* Write EOI, the last sub-block and the block terminator */
+    void finish()
+    {
+        write(eoi_code);
+
+        for (; nbits > 0; nbits -= 8)
+        {
+            put(acc & 0xFF);
+            acc >>= 8;
+        }
+
+        out[block] = out.size() - block - 1;
+
+        if (out[block] != 0)
+        {
+            out.push_back(0); // an empty last sub-block already is the terminator
+        }
+    }
+
+    const int lzw_min, clear_code, eoi_code;
+
+private:
+    void reset()
+    {
+        code_size = lzw_min + 1;
+        next_code = eoi_code + 1;
+    }
+
+    void put(uint8_t byte)
+    {
+        out.push_back(byte);
+
+        if (out.size() - block == 256)
+        {
+            out[block] = 255;
+            block = out.size();
+            out.push_back(0);
+        }
+    }
+
+    /* 8 bytes, little-endian, in one go unless they cross into the next sub-block */
+    void put8(uint64_t bits)
+    {
+        if (out.size() - block + 8 < 256)
+        {
+            size_t at = out.size();
+            out.resize(at + 8);
+
+            for (int i = 0; i < 8; ++i)
+            {
+                out[at + i] = uint8_t(bits >> (8 * i));
+            }
+
+            return;
+        }
+
+        for (int i = 0; i < 8; ++i)
+        {
+            put(uint8_t(bits >> (8 * i)));
+        }
+    }
+
+    int code_size;
+    int next_code;
+
+    std::vector<uint8_t>& out;
+    size_t block; // length byte of the sub-block being filled
+    uint64_t acc = 0; // codes are packed starting from the least significant bit, like the decoder reads them
+    int nbits = 0; // always less than 64
+};
+
+/*
+LZW-compress n color indices and append them to out as the image data of a frame:
+minimum code size, data sub-blocks and the block terminator.
+
+By default the string table is cleared whenever it fills up. If clear_at is given, it's cleared
+right before each of the (increasing) positions in it instead, and once full it's used as it is
+until the next one (a "deferred clear", which decoders have to support).
+*/
+inline void lzw_encode(const uint8_t* indices, size_t n, int lzw_min, std::vector<uint8_t>& out, const std::vector<size_t>* clear_at = nullptr)
+{
+    LZWWriter writer(lzw_min, out);
+    LZWTable table;
+    size_t next_clear = 0; // in clear_at
+    size_t clear_pos = clear_at != nullptr && !clear_at->empty() ? (*clear_at)[0] : SIZE_MAX;
+
+    if (n > 0)
+    {
+        int prefix = indices[0];
+
+        for (size_t i = 1; i < n; ++i)
+        {
+            int k = indices[i];
+
+            if (i == clear_pos)
+            {
+                writer.write(prefix);
+                writer.add_entry();
+                writer.clear();
+                table.clear();
+                next_clear++;
+                clear_pos = next_clear < clear_at->size() ? (*clear_at)[next_clear] : SIZE_MAX;
+                prefix = k;
+                continue;
+            }
+
+            size_t slot;
+            int code = table.find(prefix, k, slot);
+
+            if (code >= 0)
+            {
+                prefix = code;
+                continue;
+            }
+
+            writer.write(prefix);
+
+            if (writer.next() < 0x1000)
+            {
+                table.insert(slot, prefix, k, writer.next());
+                writer.add_entry();
+            }
+            else if (clear_at == nullptr)
+            {
+                writer.clear();
+                table.clear();
+            }
+
+            prefix = k;
+        }
+
+        writer.write(prefix);
+        writer.add_entry();
+    }
+
+    writer.finish();
+}
+
+/*
+Greedy choice between two indices per pixel that makes lzw_encode() output smaller: indices[i]
+may be replaced by alt[i] (the same value where there's no choice), for example the transparent
+index by the real color of a pixel that didn't change. The string table is modelled the way
+lzw_encode() builds it. A pixel takes whichever choice extends the current string; if neither
+does, it takes the same kind as the pixel before, so runs stay together. Returns the size of the
+code stream in bits; with alt = nullptr nothing is changed and the size is only measured.
+*/
+inline size_t lzw_choose_indices(uint8_t* indices, const uint8_t* alt, size_t n, int lzw_min)
+{
+    int eoi_code = (1 << lzw_min) + 1;
+    int code_size = lzw_min + 1;
+    int next_code = eoi_code + 1;
+    size_t bits = code_size; // clear code
+
+    if (n == 0)
+    {
+        return bits + code_size;
+    }
+
+    LZWTable table;
+    bool took_alt = false; // for the last pixel with a choice
+    int prefix = indices[0];
+
+    for (size_t i = 1; i < n; ++i)
+    {
+        int k = indices[i];
+        size_t slot;
+        int code;
+
+        if (alt != nullptr && alt[i] != k)
+        {
+            int a = took_alt ? alt[i] : k; // tried first
+            int b = took_alt ? k : alt[i];
+            size_t slot_b;
+            int code_b;
+
+            code = table.find(prefix, a, slot);
+
+            if (code >= 0 || (code_b = table.find(prefix, b, slot_b)) < 0)
+            {
+                k = a;
+            }
+            else
+            {
+                k = b;
+                code = code_b;
+            }
+
+            took_alt = k == alt[i];
+            indices[i] = k;
+        }
+        else
+        {
+            code = table.find(prefix, k, slot);
+        }
+
+        if (code >= 0)
+        {
+            prefix = code;
+            continue;
+        }
+
+        bits += code_size;
+
+        if (next_code < 0x1000)
+        {
+            table.insert(slot, prefix, k, next_code);
+            next_code++;
+
+            if (next_code > (1 << code_size) && code_size < 12)
+            {
+                code_size++;
+            }
+        }
+        else
+        {
+            bits += code_size; // clear code
+            table.clear();
+            code_size = lzw_min + 1;
+            next_code = eoi_code + 1;
+        }
+
+        prefix = k;
+    }
+
+    bits += code_size; // the last string
+
+    if (next_code < 0x1000 && next_code + 1 > (1 << code_size) && code_size < 12)
+    {
+        code_size++;
+    }
+
+    return bits + code_size; // EOI
+}
+
+/* Image descriptor, local color table and compressed indices of one frame */
+inline void write_image(std::vector<uint8_t>& out, int left, int top, size_t width, size_t height,
+                        const std::vector<Color>& lct, const uint8_t* indices, size_t ncolors)
+{
+    write_image_descriptor(out, left, top, width, height, lct);
+    lzw_encode(indices, width * height, lzw_min_code_size(ncolors), out);
+}
+
+/* 5 bits per channel, index into the quantization histogram */
+inline int color_key15(uint32_t pixel)
+{
+    return ((pixel >> 9) & 0x7C00) | ((pixel >> 6) & 0x03E0) | ((pixel >> 3) & 0x001F);
+}
+
+inline uint32_t color_distance(const Color& a, const Color& b)
+{
+    int dr = int(a.r) - b.r;
+    int dg = int(a.g) - b.g;
+    int db = int(a.b) - b.b;
+
+    return dr * dr * 3 + dg * dg * 4 + db * db * 2; // rough perceptual weights
+}
+
+inline int nearest_color(const std::vector<Color>& palette, const Color& c)
+{
+    int best = 0;
+    uint32_t best_dist = UINT32_MAX;
+
+    for (size_t i = 0; i < palette.size(); ++i)
+    {
+        uint32_t d = color_distance(palette[i], c);
+
+        if (d < best_dist)
+        {
+            best_dist = d;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+/*
+Median cut over a 15-bit color histogram: repeatedly split the box with the most pixels along
+its longest axis until there are max_colors boxes, then use the mean color of each box.
+*/
+inline std::vector<Color> median_cut(const std::vector<uint32_t>& histogram, int max_colors)
+{
+    struct Box
+    {
+        std::vector<int> keys; // histogram bins in the box
+        uint64_t count;
+    };
+
+    auto channel = [](int key, int c) { return (key >> (10 - 5 * c)) & 0x1F; }; // 0 = r, 1 = g, 2 = b
+
+    std::vector<Box> boxes(1);
+    boxes[0].count = 0;
+
+    for (int key = 0; key < 0x8000; ++key)
+    {
+        if (histogram[key] != 0)
+        {
+            boxes[0].keys.push_back(key);
+            boxes[0].count += histogram[key];
+        }
+    }
+
+    while (int(boxes.size()) < max_colors)
+    {
+        int split = -1;
+
+        for (size_t i = 0; i < boxes.size(); ++i)
+        {
+            if (boxes[i].keys.size() > 1 && (split < 0 || boxes[i].count > boxes[split].count))
+            {
+                split = i;
+            }
+        }
+
+        if (split < 0)
+        {
+            break; // every box holds a single color
+        }
+
+        Box& box = boxes[split];
+        int lo[3] = {31, 31, 31};
+        int hi[3] = {0, 0, 0};
+
+        for (int key : box.keys)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                lo[c] = std::min(lo[c], channel(key, c));
+                hi[c] = std::max(hi[c], channel(key, c));
+            }
+        }
+
+        int axis = 0;
+
+        for (int c = 1; c < 3; ++c)
+        {
+            if (hi[c] - lo[c] > hi[axis] - lo[axis])
+            {
+                axis = c;
+            }
+        }
+
+        std::sort(box.keys.begin(), box.keys.end(), [&](int a, int b) { return channel(a, axis) < channel(b, axis); });
+
+        uint64_t half = 0;
+        size_t median = 0;
+
+        while (median < box.keys.size() - 1 && half + histogram[box.keys[median]] <= box.count / 2)
+        {
+            half += histogram[box.keys[median++]];
+        }
+
+        median = std::max<size_t>(median, 1);
+
+        Box upper;
+        upper.keys.assign(box.keys.begin() + median, box.keys.end());
+        upper.count = 0;
+
+        for (int key : upper.keys)
+        {
+            upper.count += histogram[key];
+        }
+
+        box.keys.resize(median);
+        box.count -= upper.count;
+        boxes.push_back(upper);
+    }
+
+    std::vector<Color> palette;
+
+    for (auto& box : boxes)
+    {
+        uint64_t sum[3] = {0, 0, 0};
+
+        for (int key : box.keys)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                sum[c] += uint64_t(channel(key, c) * 255 / 31) * histogram[key];
+            }
+        }
+
+        if (box.count > 0)
+        {
+            palette.push_back(Color{uint8_t(sum[0] / box.count), uint8_t(sum[1] / box.count), uint8_t(sum[2] / box.count)});
+        }
+    }
+
+    return palette;
+}
+
+/*
+Reduce n pixels (BGRA, see color_rgba) to at most max_colors colors. The colors are used as they
+are if there are few enough of them, otherwise the palette comes from median_cut().
+*/
+inline void quantize(const uint32_t* pixels, size_t n, int max_colors, std::vector<Color>& palette, std::vector<uint8_t>& indices)
+{
+    std::unordered_map<uint32_t, uint8_t> exact;
+    bool fits = true;
+
+    palette.clear();
+    indices.resize(n);
+
+    for (size_t i = 0; i < n && fits; ++i)
+    {
+        uint32_t rgb = pixels[i] & 0xFFFFFF;
+        auto it = exact.find(rgb);
+
+        if (it == exact.end())
+        {
+            if (int(palette.size()) == max_colors)
+            {
+                fits = false; // too many colors
+                break;
+            }
+
+            it = exact.emplace(rgb, palette.size()).first;
+            palette.push_back(Color{uint8_t(rgb >> 16), uint8_t(rgb >> 8), uint8_t(rgb)});
+        }
+
+        indices[i] = it->second;
+    }
+
+    if (fits)
+    {
+        return;
+    }
+
+    std::vector<uint32_t> histogram(0x8000, 0);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        histogram[color_key15(pixels[i])]++;
+    }
+
+    palette = median_cut(histogram, max_colors);
+
+    std::vector<int16_t> lookup(0x8000, -1); // nearest palette entry of each histogram bin, filled lazily
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint32_t p = pixels[i];
+        int key = color_key15(p);
+
+        if (lookup[key] < 0)
+        {
+            lookup[key] = nearest_color(palette, Color{uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p)});
+        }
+
+        indices[i] = lookup[key];
+    }
+}
+
+#endif
@@ -0,0 +1,632 @@
+/*
+Spatial effects (filters) on composited canvases
+
+Effects that need the neighborhood or position of a pixel can't be done on the color tables
+(see gif_effects.h), so they run on the BGRA pixels after compositing. Pixels are processed four
+at a time in planar form, a 4 x float SIMD register (SSE2 when available) per channel, and rows
+are split into bands that are processed by several threads. A chain of filters works in place on
+the frame, with one scratch frame and a scratch row per thread that are kept between frames.
+*/
+
+#ifndef GIF_FILTERS_H
+#define GIF_FILTERS_H
+
+#include "gif.h"
+#include "gif_parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+Four pixels in planar form: the b, g, r and a values of four pixels (side by side in a row, or
+one from each of four rows) in one 4 x float register each, so every operation works on the four
+pixels at once. F4 holds one float per pixel, like a factor or a distance.
+*/
+struct Px4
+{
+#ifdef __SSE2__
+    __m128 b, g, r, a;
+#else
+    float b[4], g[4], r[4], a[4];
+#endif
+};
+
+struct F4
+{
+#ifdef __SSE2__
+    __m128 v;
+#else
+    float v[4];
+#endif
+};
+
+#ifdef __SSE2__
+
+/* The four pixels p0 to p3 into planes */
+inline Px4 px4_set(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+    __m128i v = _mm_set_epi32(int(p3), int(p2), int(p1), int(p0));
+    __m128i byte = _mm_set1_epi32(0xFF);
+
+    return Px4{_mm_cvtepi32_ps(_mm_and_si128(v, byte)),
+               _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), byte)),
+               _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), byte)),
+               _mm_cvtepi32_ps(_mm_srli_epi32(v, 24))};
+}
+
+inline Px4 px4_load(const uint32_t* p)
+{
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i byte = _mm_set1_epi32(0xFF);
+
+    return Px4{_mm_cvtepi32_ps(_mm_and_si128(v, byte)),
+               _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), byte)),
+               _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), byte)),
+               _mm_cvtepi32_ps(_mm_srli_epi32(v, 24))};
+}
+
+/* Round and saturate to 0 - 255, then interleave back into BGRA pixels */
+inline void px4_store(uint32_t* p, Px4 x)
+{
+    __m128 lo = _mm_setzero_ps();
+    __m128 hi = _mm_set1_ps(255);
+    __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(x.b, lo), hi));
+    __m128i g = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(x.g, lo), hi));
+    __m128i r = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(x.r, lo), hi));
+    __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(x.a, lo), hi));
+    __m128i v = _mm_or_si128(_mm_or_si128(b, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(r, 16), _mm_slli_epi32(a, 24)));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+}
+
+inline Px4 px4_zero() { return Px4{_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()}; }
+inline Px4 operator+(Px4 x, Px4 y) { return Px4{_mm_add_ps(x.b, y.b), _mm_add_ps(x.g, y.g), _mm_add_ps(x.r, y.r), _mm_add_ps(x.a, y.a)}; }
+inline Px4 operator-(Px4 x, Px4 y) { return Px4{_mm_sub_ps(x.b, y.b), _mm_sub_ps(x.g, y.g), _mm_sub_ps(x.r, y.r), _mm_sub_ps(x.a, y.a)}; }
+inline Px4 operator*(Px4 x, F4 k) { return Px4{_mm_mul_ps(x.b, k.v), _mm_mul_ps(x.g, k.v), _mm_mul_ps(x.r, k.v), _mm_mul_ps(x.a, k.v)}; }
+
+inline F4 f4_set(float k) { return F4{_mm_set1_ps(k)}; }
+inline F4 f4_load(const float* p) { return F4{_mm_loadu_ps(p)}; }
+inline F4 operator-(F4 x, F4 y) { return F4{_mm_sub_ps(x.v, y.v)}; }
+inline F4 f4_max(F4 x, F4 y) { return F4{_mm_max_ps(x.v, y.v)}; }
+inline F4 f4_min(F4 x, F4 y) { return F4{_mm_min_ps(x.v, y.v)}; }
+inline F4 f4_div(F4 x, F4 y) { return F4{_mm_div_ps(x.v, y.v)}; }
+
+/* The colors of x with the alpha values of y */
+inline Px4 px4_alpha(Px4 x, Px4 y) { return Px4{x.b, x.g, x.r, y.a}; }
+
+/* b * b + g * g + r * r of every pixel */
+inline F4 px4_dot3(Px4 x)
+{
+    return F4{_mm_add_ps(_mm_add_ps(_mm_mul_ps(x.b, x.b), _mm_mul_ps(x.g, x.g)), _mm_mul_ps(x.r, x.r))};
+}
+
+/* Running sums: pixel i becomes the sum of pixels 0 to i */
+inline Px4 px4_scan(Px4 x)
+{
+    auto scan = [](__m128 v)
+    {
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+        return _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+    };
+
+    return Px4{scan(x.b), scan(x.g), scan(x.r), scan(x.a)};
+}
+
+/* Every pixel becomes the last one */
+inline Px4 px4_last(Px4 x)
+{
+    return Px4{_mm_shuffle_ps(x.b, x.b, 0xFF), _mm_shuffle_ps(x.g, x.g, 0xFF), _mm_shuffle_ps(x.r, x.r, 0xFF), _mm_shuffle_ps(x.a, x.a, 0xFF)};
+}
+
+/* Whether x < y for none of the four */
+inline bool f4_none_less(F4 x, F4 y) { return _mm_movemask_ps(_mm_cmplt_ps(x.v, y.v)) == 0; }
+
+/* Every pixel becomes the sum of the four */
+inline Px4 px4_hsum(Px4 x)
+{
+    auto hsum = [](__m128 v)
+    {
+        v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    };
+
+    return Px4{hsum(x.b), hsum(x.g), hsum(x.r), hsum(x.a)};
+}
+
+#else
+
+inline Px4 px4_set(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+    uint32_t p[4] = {p0, p1, p2, p3};
+    Px4 x;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        x.b[i] = float(p[i] & 0xFF);
+        x.g[i] = float((p[i] >> 8) & 0xFF);
+        x.r[i] = float((p[i] >> 16) & 0xFF);
+        x.a[i] = float(p[i] >> 24);
+    }
+
+    return x;
+}
+
+inline Px4 px4_load(const uint32_t* p) { return px4_set(p[0], p[1], p[2], p[3]); }
+
+inline void px4_store(uint32_t* p, Px4 x)
+{
+    auto channel = [](float v) { v = std::nearbyint(v); return uint32_t(v <= 0 ? 0 : v >= 255 ? 255 : v); };
+
+    for (int i = 0; i < 4; ++i)
+    {
+        p[i] = channel(x.b[i]) | (channel(x.g[i]) << 8) | (channel(x.r[i]) << 16) | (channel(x.a[i]) << 24);
+    }
+}
+
+template<typename Op>
+Px4 px4_map(Px4 x, Op op)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        op(x.b[i], i);
+        op(x.g[i], i);
+        op(x.r[i], i);
+        op(x.a[i], i);
+    }
+
+    return x;
+}
+
+inline Px4 px4_zero() { return Px4{{0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}, {0, 0, 0, 0}}; }
+inline Px4 operator+(Px4 x, Px4 y) { for (int i = 0; i < 4; ++i) { x.b[i] += y.b[i]; x.g[i] += y.g[i]; x.r[i] += y.r[i]; x.a[i] += y.a[i]; } return x; }
+inline Px4 operator-(Px4 x, Px4 y) { for (int i = 0; i < 4; ++i) { x.b[i] -= y.b[i]; x.g[i] -= y.g[i]; x.r[i] -= y.r[i]; x.a[i] -= y.a[i]; } return x; }
+inline Px4 operator*(Px4 x, F4 k) { return px4_map(x, [&](float& v, int i) { v *= k.v[i]; }); }
+
+inline F4 f4_set(float k) { return F4{{k, k, k, k}}; }
+inline F4 f4_load(const float* p) { return F4{{p[0], p[1], p[2], p[3]}}; }
+inline F4 operator-(F4 x, F4 y) { for (int i = 0; i < 4; ++i) x.v[i] -= y.v[i]; return x; }
+inline F4 f4_max(F4 x, F4 y) { for (int i = 0; i < 4; ++i) x.v[i] = std::max(x.v[i], y.v[i]); return x; }
+inline F4 f4_min(F4 x, F4 y) { for (int i = 0; i < 4; ++i) x.v[i] = std::min(x.v[i], y.v[i]); return x; }
+inline F4 f4_div(F4 x, F4 y) { for (int i = 0; i < 4; ++i) x.v[i] /= y.v[i]; return x; }
+
+inline Px4 px4_alpha(Px4 x, Px4 y)
+{
+    std::copy(y.a, y.a + 4, x.a);
+    return x;
+}
+
+inline F4 px4_dot3(Px4 x)
+{
+    F4 d;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        d.v[i] = x.b[i] * x.b[i] + x.g[i] * x.g[i] + x.r[i] * x.r[i];
+    }
+
+    return d;
+}
+
+inline Px4 px4_scan(Px4 x)
+{
+    for (float* c : {x.b, x.g, x.r, x.a})
+    {
+        c[1] += c[0];
+        c[2] += c[1];
+        c[3] += c[2];
+    }
+
+    return x;
+}
+
+inline Px4 px4_last(Px4 x)
+{
+    for (float* c : {x.b, x.g, x.r, x.a})
+    {
+        c[0] = c[1] = c[2] = c[3];
+    }
+
+    return x;
+}
+
+inline bool f4_none_less(F4 x, F4 y) { return !(x.v[0] < y.v[0] || x.v[1] < y.v[1] || x.v[2] < y.v[2] || x.v[3] < y.v[3]); }
+
+inline Px4 px4_hsum(Px4 x)
+{
+    for (float* c : {x.b, x.g, x.r, x.a})
+    {
+        c[0] = c[1] = c[2] = c[3] = (c[0] + c[1]) + (c[2] + c[3]);
+    }
+
+    return x;
+}
+
+#endif
+
+inline Px4 operator*(Px4 x, float k) { return x * f4_set(k); }
+
+/* The first n (up to 4) pixels at p, the others are zero */
+inline Px4 px4_load(const uint32_t* p, size_t n)
+{
+    if (n >= 4)
+    {
+        return px4_load(p);
+    }
+
+    uint32_t t[4] = {0, 0, 0, 0};
+    std::copy(p, p + n, t);
+
+    return px4_load(t);
+}
+
+/* Only the first n (up to 4) pixels are written */
+inline void px4_store(uint32_t* p, Px4 x, size_t n)
+{
+    if (n >= 4)
+    {
+        px4_store(p, x);
+        return;
+    }
+
+    uint32_t t[4];
+    px4_store(t, x);
+    std::copy(t, t + n, p);
+}
+
+typedef enum FilterType
+{
+    FILTER_BLUR = 0,
+    FILTER_SHARPEN,
+    FILTER_PIXELATE,
+    FILTER_VIGNETTE,
+    FILTER_CHROMA_KEY
+} FilterType;
+
+const std::string filter_type_str[5] = {
+    "blur",
+    "sharpen",
+    "pixelate",
+    "vignette",
+    "chromakey"
+};
+
+/*
+- blur: box blur, amount = radius in pixels (up to 32767, so that the sums stay exact)
+- sharpen: amount = strength of the 3x3 unsharp mask (0 - 16), alpha is left as it is
+- pixelate: amount = block size in pixels (up to 65535)
+- vignette: amount = how dark the corners get (0 - 1)
+- chromakey: pixels within amount (RGB distance, 0 - 442) of color become transparent
+*/
+struct Filter
+{
+    FilterType type;
+    float amount;
+    Color color;
+};
+
+/* Parse NAME[:AMOUNT] or chromakey:RRGGBB[:TOLERANCE]; returns false for unknown filters, malformed numbers or colors and amounts out of range */
+inline bool parse_filter(const std::string& spec, Filter& filter)
+{
+    std::vector<std::string> parts;
+    std::stringstream ss(spec);
+    std::string part;
+
+    while (std::getline(ss, part, ':'))
+    {
+        parts.push_back(part);
+    }
+
+    if (parts.empty())
+    {
+        return false;
+    }
+
+    auto type = std::find(filter_type_str, filter_type_str + 5, parts[0]);
+
+    if (type == filter_type_str + 5)
+    {
+        return false;
+    }
+
+    filter.type = FilterType(type - filter_type_str);
+    filter.amount = filter.type == FILTER_BLUR ? 2 : filter.type == FILTER_PIXELATE ? 8 : filter.type == FILTER_CHROMA_KEY ? 60 : 0.7f;
+    filter.color = Color{0, 255, 0};
+
+    bool ok;
+
+    if (filter.type == FILTER_CHROMA_KEY)
+    {
+        ok = parts.size() <= 3 && (parts.size() <= 1 || parse_rgb(parts[1], filter.color)) &&
+             (parts.size() <= 2 || parse_float(parts[2], filter.amount));
+    }
+    else
+    {
+        ok = parts.size() <= 2 && (parts.size() <= 1 || parse_float(parts[1], filter.amount));
+    }
+
+    // bounded, so that the loops over a radius or block size stay short
+    const float max_amount[5] = {32767, 16, 65535, 1, 442};
+
+    return ok && filter.amount >= 0 && filter.amount <= max_amount[filter.type];
+}
+
+class FilterChain
+{
+public:
+    FilterChain() : threads(std::max(1u, std::thread::hardware_concurrency())) {}
+
+    /* Run every filter over the width x height frame in place */
+    void apply(uint32_t* pixels, size_t width, size_t height)
+    {
+        for (auto& f : filters)
+        {
+            switch (f.type)
+            {
+            case FILTER_BLUR: blur(pixels, width, height, size_amount(f, 32767)); break;
+            case FILTER_SHARPEN: sharpen(pixels, width, height, f.amount); break;
+            case FILTER_PIXELATE: pixelate(pixels, width, height, size_amount(f, 65535)); break;
+            case FILTER_VIGNETTE: vignette(pixels, width, height, f.amount); break;
+            case FILTER_CHROMA_KEY: chroma_key(pixels, width, height, f.color, f.amount); break;
+            }
+        }
+    }
+
+    std::vector<Filter> filters;
+    int threads;
+
+private:
+    /* Radius or block size of f, from 1 to limit (also for filters that didn't come from parse_filter) */
+    static int size_amount(const Filter& f, int limit)
+    {
+        return f.amount >= limit ? limit : std::max(1, int(std::max(f.amount, 0.0f) + 0.5f));
+    }
+
+    /*
+    Separable box blur: rows into the scratch frame, then columns back into the frame. Along a row
+    the window sum of four pixels at a time is the one before them plus a running sum of what
+    enters and leaves the window; the sums are whole numbers, so they're exact in any order. The
+    columns keep a window sum per column, four columns to a register.
+    */
+    void blur(uint32_t* pixels, size_t width, size_t height, int radius)
+    {
+        scratch.resize(width * height);
+        float inv = 1.0f / (2 * radius + 1);
+
+        parallel_rows(height, width, threads, [&](size_t y0, size_t y1)
+        {
+            for (size_t y = y0; y < y1; ++y)
+            {
+                const uint32_t* src = pixels + y * width;
+                uint32_t* dst = &scratch[y * width];
+                auto at = [&](long x) { uint32_t p = src[std::min<size_t>(std::max(x, 0L), width - 1)]; return px4_set(p, p, p, p); };
+
+                // window sum before pixel 0, so that adding pixel radius and taking out pixel -radius - 1 gives pixel 0's
+                Px4 sum = at(0) * float(radius + 2) - at(radius);
+
+                for (int i = 1; i <= radius; ++i)
+                {
+                    sum = sum + at(i);
+                }
+
+                for (size_t x = 0; x < width; x += 4)
+                {
+                    long in = long(x) + radius; // first pixel entering the window
+                    long out = long(x) - radius - 1; // and leaving it
+                    Px4 delta;
+
+                    if (out >= 0 && in + 4 <= long(width))
+                    {
+                        delta = px4_load(src + in) - px4_load(src + out);
+                    }
+                    else
+                    {
+                        auto clamped = [&](long i) { return src[std::min<size_t>(std::max(i, 0L), width - 1)]; };
+                        delta = px4_set(clamped(in), clamped(in + 1), clamped(in + 2), clamped(in + 3)) -
+                                px4_set(clamped(out), clamped(out + 1), clamped(out + 2), clamped(out + 3));
+                    }
+
+                    Px4 sums = sum + px4_scan(delta);
+
+                    px4_store(dst + x, sums * inv, width - x);
+                    sum = px4_last(sums);
+                }
+            }
+        });
+
+        size_t blocks = (width + 3) / 4;
+
+        if (band_sums.size() < size_t(threads))
+        {
+            band_sums.resize(threads);
+        }
+
+        parallel_bands(height, width, threads, [&](size_t y0, size_t y1, size_t band)
+        {
+            std::vector<Px4>& sums = band_sums[band];
+            auto row = [&](long y) { return &scratch[size_t(std::min(std::max(y, 0L), long(height) - 1)) * width]; };
+
+            sums.assign(blocks, px4_zero());
+
+            for (long y = long(y0) - radius; y <= long(y0) + radius; ++y)
+            {
+                const uint32_t* src = row(y);
+
+                for (size_t i = 0, x = 0; i < blocks; ++i, x += 4)
+                {
+                    sums[i] = sums[i] + px4_load(src + x, width - x);
+                }
+            }
+
+            for (size_t y = y0; y < y1; ++y)
+            {
+                uint32_t* dst = pixels + y * width;
+                const uint32_t* add = row(long(y) + radius + 1);
+                const uint32_t* sub = row(long(y) - radius);
+
+                for (size_t i = 0, x = 0; i < blocks; ++i, x += 4)
+                {
+                    px4_store(dst + x, sums[i] * inv, width - x);
+                    sums[i] = sums[i] + px4_load(add + x, width - x) - px4_load(sub + x, width - x);
+                }
+            }
+        });
+    }
+
+    /* out = center + amount * (4 * center - left - right - up - down) */
+    void sharpen(uint32_t* pixels, size_t width, size_t height, float amount)
+    {
+        scratch.assign(pixels, pixels + width * height);
+
+        parallel_rows(height, width, threads, [&](size_t y0, size_t y1)
+        {
+            for (size_t y = y0; y < y1; ++y)
+            {
+                const uint32_t* up = &scratch[(y > 0 ? y - 1 : 0) * width];
+                const uint32_t* mid = &scratch[y * width];
+                const uint32_t* down = &scratch[std::min(y + 1, height - 1) * width];
+                uint32_t* dst = pixels + y * width;
+
+                // the four pixels left and right of x, x + 1, x + 2 and x + 3, repeating the edges
+                auto shifted = [&](size_t x, int dx)
+                {
+                    if (x >= 1 && x + 5 <= width)
+                    {
+                        return px4_load(mid + x + dx);
+                    }
+
+                    auto at = [&](size_t i) { return mid[std::min<size_t>(std::max<long>(long(i) + dx, 0), width - 1)]; };
+                    return px4_set(at(x), at(x + 1), at(x + 2), at(x + 3));
+                };
+
+                for (size_t x = 0; x < width; x += 4)
+                {
+                    size_t n = width - x;
+                    Px4 c = px4_load(mid + x, n);
+                    Px4 around = px4_load(up + x, n) + px4_load(down + x, n) + shifted(x, -1) + shifted(x, 1);
+
+                    px4_store(dst + x, px4_alpha(c + (c * 4 - around) * amount, c), n);
+                }
+            }
+        });
+    }
+
+    /* Every block x block square takes its mean color */
+    void pixelate(uint32_t* pixels, size_t width, size_t height, int block)
+    {
+        size_t rows = (height + block - 1) / block;
+
+        parallel_rows(rows, width * block, threads, [&](size_t r0, size_t r1)
+        {
+            for (size_t r = r0; r < r1; ++r)
+            {
+                size_t y0 = r * block;
+                size_t y1 = std::min(y0 + block, height);
+
+                for (size_t x0 = 0; x0 < width; x0 += block)
+                {
+                    size_t x1 = std::min(x0 + block, width);
+                    Px4 sum = px4_zero();
+
+                    for (size_t y = y0; y < y1; ++y)
+                    {
+                        for (size_t x = x0; x < x1; x += 4)
+                        {
+                            sum = sum + px4_load(pixels + y * width + x, x1 - x);
+                        }
+                    }
+
+                    uint32_t mean[4];
+                    px4_store(mean, px4_hsum(sum) * (1.0f / ((y1 - y0) * (x1 - x0))));
+
+                    for (size_t y = y0; y < y1; ++y)
+                    {
+                        std::fill(pixels + y * width + x0, pixels + y * width + x1, mean[0]);
+                    }
+                }
+            }
+        });
+    }
+
+    /* Darken towards the corners: factor = 1 - strength * distance^2 / corner distance^2 */
+    void vignette(uint32_t* pixels, size_t width, size_t height, float strength)
+    {
+        float cx = (width - 1) / 2.0f;
+        float cy = (height - 1) / 2.0f;
+        float inv = strength / (cx * cx + cy * cy + 1);
+
+        std::vector<float> column((width + 3) / 4 * 4, 0.0f); // the x part of the distance is the same for every row
+
+        for (size_t x = 0; x < width; ++x)
+        {
+            column[x] = (x - cx) * (x - cx) * inv;
+        }
+
+        parallel_rows(height, width, threads, [&](size_t y0, size_t y1)
+        {
+            for (size_t y = y0; y < y1; ++y)
+            {
+                F4 row = f4_set(1 - (y - cy) * (y - cy) * inv);
+                uint32_t* dst = pixels + y * width;
+
+                for (size_t x = 0; x < width; x += 4)
+                {
+                    Px4 p = px4_load(dst + x, width - x);
+                    Px4 dark = p * f4_max(row - f4_load(&column[x]), f4_set(0));
+
+                    px4_store(dst + x, px4_alpha(dark, p), width - x); // only the color gets darker
+                }
+            }
+        });
+    }
+
+    /* Pixels close to key become transparent, with a soft edge up to 1.5 x tolerance */
+    void chroma_key(uint32_t* pixels, size_t width, size_t height, const Color& key, float tolerance)
+    {
+        if (tolerance <= 0)
+        {
+            return;
+        }
+
+        uint32_t k = color_rgba(key.r, key.g, key.b, 0);
+        Px4 keys = px4_set(k, k, k, k);
+        float inner = tolerance * tolerance;
+        float outer = 2.25f * inner;
+        F4 inner4 = f4_set(inner);
+        F4 outer4 = f4_set(outer);
+        F4 range = f4_set(outer - inner);
+
+        parallel_rows(height, width, threads, [&](size_t y0, size_t y1)
+        {
+            for (size_t y = y0; y < y1; ++y)
+            {
+                uint32_t* dst = pixels + y * width;
+
+                for (size_t x = 0; x < width; x += 4)
+                {
+                    Px4 p = px4_load(dst + x, width - x);
+                    F4 dist = px4_dot3(p - keys);
+
+                    if (f4_none_less(dist, outer4))
+                    {
+                        continue; // none of them is close to the key
+                    }
+
+                    // 0 up to inner, 1 from outer on, which leaves the pixel as it is
+                    F4 alpha = f4_min(f4_max(f4_div(dist - inner4, range), f4_set(0)), f4_set(1));
+
+                    px4_store(dst + x, p * alpha, width - x); // premultiplied, so the color goes too
+                }
+            }
+        });
+    }
+
+    std::vector<uint32_t> scratch;
+    std::vector<std::vector<Px4>> band_sums; // column sums of the blur, one row per thread
+};
+
+#endif
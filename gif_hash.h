@@ -0,0 +1,223 @@
+/*
+Perceptual hashes (dHash and pHash) of frames, for finding duplicates and near duplicates
+
+The hashes only look at a 32 x 32 (pHash) or 9 x 8 (dHash) grayscale thumbnail, so they are taken
+from the smallest pyramid level (see gif_pyramid.h) that is still at least 32 pixels on each side,
+right after the frame was composited. Only the selected frames and what they depend on are decoded.
+*/
+
+#ifndef GIF_HASH_H
+#define GIF_HASH_H
+
+#include "gif.h"
+#include "gif_canvas.h"
+#include "gif_pyramid.h"
+
+#include <algorithm>
+#include <cmath>
+
+struct FrameHash
+{
+    size_t frame;
+    uint64_t dhash;
+    uint64_t phash;
+};
+
+/* Box filter pixels down (or nearest neighbor up) to a tw x th grayscale thumbnail */
+inline void gray_thumbnail(const uint32_t* pixels, size_t w, size_t h, int tw, int th, float* out)
+{
+    for (int ty = 0; ty < th; ++ty)
+    {
+        size_t y0 = ty * h / th;
+        size_t y1 = std::max(y0 + 1, (ty + 1) * h / th);
+
+        for (int tx = 0; tx < tw; ++tx)
+        {
+            size_t x0 = tx * w / tw;
+            size_t x1 = std::max(x0 + 1, (tx + 1) * w / tw);
+            float sum = 0;
+
+            for (size_t y = y0; y < y1; ++y)
+            {
+                for (size_t x = x0; x < x1; ++x)
+                {
+                    uint32_t p = pixels[y * w + x];
+                    sum += 0.299f * ((p >> 16) & 0xFF) + 0.587f * ((p >> 8) & 0xFF) + 0.114f * (p & 0xFF);
+                }
+            }
+
+            out[ty * tw + tx] = sum / ((y1 - y0) * (x1 - x0));
+        }
+    }
+}
+
+/* One bit per pixel of a 9 x 8 thumbnail: brighter than its right neighbor */
+inline uint64_t dhash(const uint32_t* pixels, size_t w, size_t h)
+{
+    float thumb[9 * 8];
+    uint64_t hash = 0;
+
+    gray_thumbnail(pixels, w, h, 9, 8, thumb);
+
+    for (int y = 0; y < 8; ++y)
+    {
+        for (int x = 0; x < 8; ++x)
+        {
+            hash = (hash << 1) | (thumb[y * 9 + x] > thumb[y * 9 + x + 1]);
+        }
+    }
+
+    return hash;
+}
+
+/* One bit per low frequency (8 x 8 of the DCT of a 32 x 32 thumbnail): above the median */
+inline uint64_t phash(const uint32_t* pixels, size_t w, size_t h)
+{
+    struct Cosines
+    {
+        float c[8][32];
+
+        Cosines()
+        {
+            for (int u = 0; u < 8; ++u)
+            {
+                for (int x = 0; x < 32; ++x)
+                {
+                    c[u][x] = std::cos((2 * x + 1) * u * 3.14159265f / 64);
+                }
+            }
+        }
+    };
+
+    static const Cosines cosines; // initialized once, also with several threads
+
+    float thumb[32 * 32];
+    float rows[32][8]; // DCT along x, only the 8 lowest frequencies are needed
+    float dct[64];
+
+    gray_thumbnail(pixels, w, h, 32, 32, thumb);
+
+    for (int y = 0; y < 32; ++y)
+    {
+        for (int u = 0; u < 8; ++u)
+        {
+            float sum = 0;
+
+            for (int x = 0; x < 32; ++x)
+            {
+                sum += thumb[y * 32 + x] * cosines.c[u][x];
+            }
+
+            rows[y][u] = sum;
+        }
+    }
+
+    for (int v = 0; v < 8; ++v)
+    {
+        for (int u = 0; u < 8; ++u)
+        {
+            float sum = 0;
+
+            for (int y = 0; y < 32; ++y)
+            {
+                sum += rows[y][u] * cosines.c[v][y];
+            }
+
+            dct[v * 8 + u] = sum;
+        }
+    }
+
+    float sorted[63];
+    std::copy(dct + 1, dct + 64, sorted); // the DC term only says how bright the frame is
+    std::nth_element(sorted, sorted + 31, sorted + 63);
+    float median = sorted[31];
+
+    uint64_t hash = 0;
+
+    for (int i = 0; i < 64; ++i)
+    {
+        hash = (hash << 1) | (dct[i] > median);
+    }
+
+    return hash;
+}
+
+inline int hamming_distance(uint64_t a, uint64_t b)
+{
+    uint64_t x = a ^ b;
+    int n = 0;
+
+    for (; x != 0; x &= x - 1)
+    {
+        n++;
+    }
+
+    return n;
+}
+
+/* The first and the middle frame plus up to max_keyframes keyframes spread over the animation */
+inline std::vector<size_t> hash_selection(const GIF& gif, size_t max_keyframes = 8)
+{
+    std::vector<size_t> keyframes, frames;
+
+    if (gif.frames.empty())
+    {
+        return frames;
+    }
+
+    for (size_t i = 1; i < gif.frames.size(); ++i)
+    {
+        if (gif.frames[i].keyframe)
+        {
+            keyframes.push_back(i);
+        }
+    }
+
+    frames.push_back(0);
+    frames.push_back(gif.frames.size() / 2);
+
+    for (size_t k = 0; k < std::min(keyframes.size(), max_keyframes); ++k)
+    {
+        frames.push_back(keyframes[k * keyframes.size() / std::min(keyframes.size(), max_keyframes)]);
+    }
+
+    std::sort(frames.begin(), frames.end());
+    frames.erase(std::unique(frames.begin(), frames.end()), frames.end());
+
+    return frames;
+}
+
+/* Hash the given frames (in increasing order), compositing each of them from its keyframe on */
+inline void hash_frames(const GIF& gif, const std::vector<size_t>& frames, std::vector<FrameHash>& hashes)
+{
+    Snapshots snapshots(gif);
+    int levels = 0;
+
+    while (levels < 3 && (gif.canvas_width >> (levels + 1)) >= 32 && (gif.canvas_height >> (levels + 1)) >= 32)
+    {
+        levels++;
+    }
+
+    Pyramid pyramid(levels);
+    hashes.clear();
+
+    for (size_t i : frames)
+    {
+        const Canvas& canvas = snapshots.at(i);
+        const uint32_t* pixels = canvas.pixels.data();
+        size_t w = canvas.width();
+        size_t h = canvas.height();
+
+        if (levels > 0)
+        {
+            pyramid.build(pixels, w, h);
+            pixels = pyramid.pixels(levels).data();
+            w = pyramid.width(levels);
+            h = pyramid.height(levels);
+        }
+
+        hashes.push_back(FrameHash{i, dhash(pixels, w, h), phash(pixels, w, h)});
+    }
+}
+
+#endif
@@ -0,0 +1,174 @@
+/*
+print canvas size, frame count, duration and loop count of GIF files without decoding them
+
+to compile: g++ gif_info.cpp -o gif_info -std=c++14 -O2 -pthread
+usage: gif_info [--hash] [--motion] [FILE NAME].gif...
+
+--hash also prints dHash and pHash of the first, the middle and some keyframes, which needs
+decoding those frames (and the ones they are drawn on top of)
+
+--motion also prints how much of the canvas every frame changes, the scene cuts and a frame to use
+as thumbnail, which needs decoding the whole animation
+
+the files are read on one thread per core, the output comes in the order of the arguments
+*/
+
+#include "gif.h"
+#include "gif_hash.h"
+#include "gif_motion.h"
+
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+struct InfoOptions
+{
+    bool hash = false;
+    bool motion = false;
+};
+
+/* Describe one file into out, returns false if it couldn't be read */
+bool describe_file(const char* filename, const InfoOptions& options, std::vector<uint8_t>& bytes, std::ostream& out)
+{
+    GIFInfo info;
+
+    if (!read_file(filename, bytes) || !read_gif_info(bytes.data(), bytes.size(), info))
+    {
+        return false;
+    }
+
+    out << filename << ": "
+        << info.canvas_width << "x" << info.canvas_height << ", "
+        << info.frame_count << " frames, "
+        << info.duration / 100.0 << " s, "
+        << "loop " << (info.loop_count < 0 ? "none" : info.loop_count == 0 ? "forever" : std::to_string(info.loop_count))
+        << std::endl;
+
+    if (!options.hash && !options.motion)
+    {
+        return true;
+    }
+
+    GIF gif;
+    gif.bytes.swap(bytes);
+
+    if (parse_gif(gif))
+    {
+        if (options.hash)
+        {
+            std::vector<FrameHash> hashes;
+            hash_frames(gif, hash_selection(gif), hashes);
+
+            for (auto& h : hashes)
+            {
+                out << "  frame " << h.frame << ": dhash " << std::hex << std::setfill('0') << std::setw(16) << h.dhash
+                    << " phash " << std::setw(16) << h.phash << std::dec << std::setfill(' ') << std::endl;
+            }
+        }
+
+        if (options.motion)
+        {
+            std::vector<FrameMotion> motion;
+            size_t cuts = 0;
+            double changed = 0;
+
+            analyze_motion(gif, motion);
+            out << std::fixed << std::setprecision(1);
+
+            for (auto& m : motion)
+            {
+                out << "  frame " << m.frame << ": " << m.changed * 100 << "% changed, "
+                    << m.difference * 100 << "% difference";
+
+                if (!m.rect.empty())
+                {
+                    out << ", " << m.rect.width << "x" << m.rect.height << " at " << m.rect.left << "," << m.rect.top;
+                }
+
+                out << (m.scene_cut ? ", scene cut" : "") << std::endl;
+                cuts += m.scene_cut;
+                changed += m.changed;
+            }
+
+            out << "  " << cuts << " scene cuts, " << (motion.empty() ? 0 : changed / motion.size() * 100)
+                << "% changed per frame, thumbnail frame " << representative_frame(motion) << std::endl;
+            out << std::defaultfloat << std::setprecision(6);
+        }
+    }
+
+    bytes.swap(gif.bytes);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    InfoOptions options;
+    std::vector<const char*> files;
+
+    for (int a = 1; a < argc; ++a)
+    {
+        std::string arg = argv[a];
+
+        if (arg == "--hash")
+        {
+            options.hash = true;
+        }
+        else if (arg == "--motion")
+        {
+            options.motion = true;
+        }
+        else
+        {
+            files.push_back(argv[a]);
+        }
+    }
+
+    if (files.empty())
+    {
+        std::cerr << "Usage: gif_info [--hash] [--motion] [FILE NAME].gif..." << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> outputs(files.size());
+    std::vector<char> ok(files.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    size_t thread_count = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), files.size());
+
+    for (size_t t = 0; t < thread_count; ++t)
+    {
+        workers.emplace_back([&]()
+        {
+            std::vector<uint8_t> bytes; // reused for every file of this thread
+
+            for (size_t i = next++; i < files.size(); i = next++)
+            {
+                std::ostringstream out;
+                ok[i] = describe_file(files[i], options, bytes, out);
+                outputs[i] = out.str();
+            }
+        });
+    }
+
+    for (auto& w : workers)
+    {
+        w.join();
+    }
+
+    int status = 0;
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        if (!ok[i])
+        {
+            std::cerr << "Couldn't read GIF file: " << files[i] << std::endl;
+            status = 1;
+            continue;
+        }
+
+        std::cout << outputs[i];
+    }
+
+    return status;
+}
@@ -0,0 +1,432 @@
+/*
+Reading frames for the encoder from a stream: raw RGBA, PAM or YUV4MPEG2
+
+The format is told by the first line:
+- "RGBA WIDTH HEIGHT\n", then frames of WIDTH * HEIGHT * 4 bytes (r, g, b, a)
+- PAM ("P7"), one image after another as ffmpeg's image2pipe writes them; RGB, RGB_ALPHA,
+  GRAYSCALE and GRAYSCALE_ALPHA with a MAXVAL of 255
+- YUV4MPEG2 with 4:2:0 chroma; the frame rate gives the delay time. Y'CbCr is converted with the
+  BT.601 limited range matrix, 8 pixels at a time with SSE2.
+
+encode_frames() feeds them to a StreamEncoder with reading, quantization, LZW and writing each on
+a thread of its own.
+*/
+
+#ifndef GIF_INPUT_H
+#define GIF_INPUT_H
+
+#include "gif.h"
+#include "gif_queue.h"
+#include "gif_stream.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <sstream>
+#include <thread>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* (a * b) >> 16 like _mm_mulhi_epi16, so the scalar and SSE2 conversions round the same way */
+inline int mulhi16(int a, int b)
+{
+    return (a * b) >> 16;
+}
+
+/* One pixel of the I420 conversion; y, u and v are scaled by 128 after taking out the offsets */
+inline uint32_t yuv_pixel(int y, int u, int v)
+{
+    int luma = mulhi16(y, 596); // 1.164
+    int r = luma + mulhi16(v, 818); // 1.596
+    int g = luma - mulhi16(u, 200) - mulhi16(v, 416); // 0.391, 0.813
+    int b = luma + mulhi16(u, 1032); // 2.018
+
+    auto clamp = [](int c) { return uint8_t(std::min(std::max(c, 0), 255)); };
+
+    return color_rgba(clamp(r), clamp(g), clamp(b), 255);
+}
+
+/* Convert I420 planes (chroma at half the width and height, rounded up) to BGRA pixels */
+inline void i420_to_bgra(const uint8_t* y_plane, const uint8_t* u_plane, const uint8_t* v_plane,
+                         size_t width, size_t height, uint32_t* out, bool simd = true)
+{
+    size_t chroma_width = (width + 1) / 2;
+
+    for (size_t row = 0; row < height; ++row)
+    {
+        const uint8_t* py = y_plane + row * width;
+        const uint8_t* pu = u_plane + row / 2 * chroma_width;
+        const uint8_t* pv = v_plane + row / 2 * chroma_width;
+        uint32_t* dst = out + row * width;
+        size_t x = 0;
+
+#ifdef __SSE2__
+        if (simd)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i alpha = _mm_set1_epi8(char(0xFF));
+
+            for (; x + 8 <= width; x += 8)
+            {
+                int32_t u4, v4;
+                std::memcpy(&u4, pu + x / 2, 4);
+                std::memcpy(&v4, pv + x / 2, 4);
+
+                // each chroma sample twice, everything as 16 bits scaled by 128
+                __m128i u = _mm_cvtsi32_si128(u4);
+                __m128i v = _mm_cvtsi32_si128(v4);
+                u = _mm_unpacklo_epi8(_mm_unpacklo_epi8(u, u), zero);
+                v = _mm_unpacklo_epi8(_mm_unpacklo_epi8(v, v), zero);
+                __m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(py + x)), zero);
+
+                y = _mm_slli_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), 7);
+                u = _mm_slli_epi16(_mm_sub_epi16(u, _mm_set1_epi16(128)), 7);
+                v = _mm_slli_epi16(_mm_sub_epi16(v, _mm_set1_epi16(128)), 7);
+
+                __m128i luma = _mm_mulhi_epi16(y, _mm_set1_epi16(596));
+                __m128i r = _mm_add_epi16(luma, _mm_mulhi_epi16(v, _mm_set1_epi16(818)));
+                __m128i g = _mm_sub_epi16(_mm_sub_epi16(luma, _mm_mulhi_epi16(u, _mm_set1_epi16(200))), _mm_mulhi_epi16(v, _mm_set1_epi16(416)));
+                __m128i b = _mm_add_epi16(luma, _mm_mulhi_epi16(u, _mm_set1_epi16(1032)));
+
+                // interleave into b, g, r, a bytes
+                __m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g));
+                __m128i ra = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), alpha);
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_unpacklo_epi16(bg, ra));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x + 4), _mm_unpackhi_epi16(bg, ra));
+            }
+        }
+#endif
+
+        for (; x < width; ++x)
+        {
+            dst[x] = yuv_pixel((py[x] - 16) * 128, (pu[x / 2] - 128) * 128, (pv[x / 2] - 128) * 128);
+        }
+    }
+}
+
+enum InputFormat
+{
+    IF_RAW,
+    IF_PAM,
+    IF_Y4M
+};
+
+class FrameReader
+{
+public:
+    FrameReader(std::istream& in_) : in(in_) {}
+
+    /* Read the stream header; width, height and delay_time (0 if the input doesn't say) are set */
+    bool open()
+    {
+        std::istringstream header(read_line());
+        std::string magic;
+
+        if (!in)
+        {
+            std::cerr << "No input" << std::endl;
+            return false;
+        }
+
+        header >> magic;
+
+        if (magic == "RGBA")
+        {
+            format = IF_RAW;
+            return header >> width >> height && check_size();
+        }
+        else if (magic == "P7")
+        {
+            format = IF_PAM;
+            return read_pam_header();
+        }
+        else if (magic == "YUV4MPEG2")
+        {
+            format = IF_Y4M;
+            return read_y4m_header(header);
+        }
+
+        std::cerr << "Unknown input format, expected raw RGBA, PAM or YUV4MPEG2" << std::endl;
+        return false;
+    }
+
+    /* Next frame as width * height BGRA pixels; false at the end of the input or on errors */
+    bool read(std::vector<uint32_t>& pixels)
+    {
+        pixels.resize(width * height);
+
+        switch (format)
+        {
+        case IF_RAW:
+            return read_raw(pixels);
+        case IF_PAM:
+            return read_pam(pixels);
+        case IF_Y4M:
+            return read_y4m(pixels);
+        }
+
+        return false;
+    }
+
+    InputFormat format = IF_RAW;
+    size_t width = 0, height = 0;
+    int delay_time = 0;
+
+private:
+    std::string read_line()
+    {
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+
+    bool check_size()
+    {
+        if (width == 0 || height == 0 || width > 0xFFFF || height > 0xFFFF)
+        {
+            std::cerr << "Bad frame size: " << width << "x" << height << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    /* The header lines after "P7" */
+    bool read_pam_header()
+    {
+        size_t w = 0, h = 0;
+        int maxval = 0;
+
+        depth = 0;
+
+        while (in)
+        {
+            std::istringstream line(read_line());
+            std::string key;
+            line >> key;
+
+            if (key == "ENDHDR")
+            {
+                break;
+            }
+            else if (key == "WIDTH")
+            {
+                line >> w;
+            }
+            else if (key == "HEIGHT")
+            {
+                line >> h;
+            }
+            else if (key == "DEPTH")
+            {
+                line >> depth;
+            }
+            else if (key == "MAXVAL")
+            {
+                line >> maxval;
+            }
+        }
+
+        if (!in || maxval != 255 || depth < 1 || depth > 4)
+        {
+            std::cerr << "Unsupported PAM image (needs MAXVAL 255 and DEPTH 1 to 4)" << std::endl;
+            return false;
+        }
+
+        if (width != 0 && (w != width || h != height))
+        {
+            std::cerr << "PAM images have different sizes" << std::endl;
+            return false;
+        }
+
+        width = w;
+        height = h;
+
+        return check_size();
+    }
+
+    bool read_y4m_header(std::istream& header)
+    {
+        std::string param;
+        bool chroma_420 = true;
+
+        while (header >> param)
+        {
+            const char* value = param.c_str() + 1;
+
+            switch (param[0])
+            {
+            case 'W':
+                width = std::strtoul(value, nullptr, 10);
+                break;
+            case 'H':
+                height = std::strtoul(value, nullptr, 10);
+                break;
+            case 'F':
+            {
+                double num = 0, den = 1;
+                char colon;
+
+                if (std::istringstream(value) >> num >> colon >> den && num > 0)
+                {
+                    delay_time = std::max(1, int(std::lround(100 * den / num)));
+                }
+
+                break;
+            }
+            case 'C':
+                chroma_420 = param.compare(1, 3, "420") == 0;
+                break;
+            }
+        }
+
+        if (!chroma_420)
+        {
+            std::cerr << "Only 4:2:0 YUV4MPEG2 is supported" << std::endl;
+            return false;
+        }
+
+        return check_size();
+    }
+
+    bool read_raw(std::vector<uint32_t>& pixels)
+    {
+        bytes.resize(width * height * 4);
+
+        if (!in.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            const uint8_t* p = &bytes[i * 4];
+            pixels[i] = color_rgba(p[0], p[1], p[2], p[3]);
+        }
+
+        return true;
+    }
+
+    bool read_pam(std::vector<uint32_t>& pixels)
+    {
+        if (frames_read++ > 0)
+        {
+            // every image has its own header
+            if (read_line() != "P7" || !read_pam_header())
+            {
+                return false;
+            }
+        }
+
+        bytes.resize(width * height * depth);
+
+        if (!in.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            const uint8_t* p = &bytes[i * depth];
+
+            switch (depth)
+            {
+            case 1:
+                pixels[i] = color_rgba(p[0], p[0], p[0], 255);
+                break;
+            case 2:
+                pixels[i] = color_rgba(p[0], p[0], p[0], p[1]);
+                break;
+            case 3:
+                pixels[i] = color_rgba(p[0], p[1], p[2], 255);
+                break;
+            default:
+                pixels[i] = color_rgba(p[0], p[1], p[2], p[3]);
+            }
+        }
+
+        return true;
+    }
+
+    bool read_y4m(std::vector<uint32_t>& pixels)
+    {
+        std::string line = read_line();
+
+        if (!in || line.compare(0, 5, "FRAME") != 0)
+        {
+            return false;
+        }
+
+        size_t luma = width * height;
+        size_t chroma = ((width + 1) / 2) * ((height + 1) / 2);
+
+        bytes.resize(luma + 2 * chroma);
+
+        if (!in.read(reinterpret_cast<char*>(bytes.data()), bytes.size()))
+        {
+            return false;
+        }
+
+        i420_to_bgra(&bytes[0], &bytes[luma], &bytes[luma + chroma], width, height, pixels.data());
+        return true;
+    }
+
+    std::istream& in;
+    int depth = 0; // PAM channels
+    size_t frames_read = 0;
+    std::vector<uint8_t> bytes;
+};
+
+/*
+Push every frame of reader into encoder (without finishing it). With threads, reading runs on a
+thread of its own a few frames ahead, and the encoder compresses and writes on its own threads,
+so only quantization is left on this one. False if the encoder couldn't write.
+*/
+inline bool encode_frames(FrameReader& reader, StreamEncoder& encoder, int delay_time, bool threads = true)
+{
+    std::vector<uint32_t> pixels;
+    bool ok = true;
+
+    if (!threads)
+    {
+        while (ok && reader.read(pixels))
+        {
+            ok = encoder.push(pixels.data(), delay_time);
+        }
+
+        return ok;
+    }
+
+    BoundedQueue<std::vector<uint32_t>> frames(4);
+
+    std::thread read_thread([&]()
+    {
+        std::vector<uint32_t> next;
+
+        while (reader.read(next) && frames.push(std::move(next)))
+        {
+        }
+
+        frames.close();
+    });
+
+    encoder.start_threads();
+
+    while (frames.pop(pixels))
+    {
+        if (ok && !encoder.push(pixels.data(), delay_time))
+        {
+            ok = false;
+            frames.close(); // let the reader stop
+        }
+    }
+
+    read_thread.join();
+    return ok;
+}
+
+#endif
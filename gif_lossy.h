@@ -0,0 +1,150 @@
+/*
+Lossy LZW encoding (like gifsicle's --lossy)
+
+The string table is kept as a trie. When a string is extended, the child whose last index has
+the closest color to the next pixel is taken as long as its color_distance() is at most the
+threshold, not only the one with the exact index. Strings get longer, so there are fewer codes.
+The distances between all palette entries are computed once per frame. The transparent index is
+only ever matched by itself.
+*/
+
+#ifndef GIF_LOSSY_H
+#define GIF_LOSSY_H
+
+#include "gif.h"
+#include "gif_encode.h"
+#include "gif_recompress.h"
+
+/* Largest color_distance() allowed per pixel at a given lossy level: about lossy levels on each channel */
+inline uint32_t lossy_threshold(int lossy)
+{
+    return uint32_t(lossy) * lossy * 9;
+}
+
+/*
+lzw_encode() that lets pixels change to colors at most lossy_threshold(lossy) away. palette is
+the color table the indices refer to and trans the transparent index (-1 if there's none).
+*/
+inline void lzw_encode_lossy(const uint8_t* indices, size_t n, int lzw_min, const std::vector<Color>& palette, int trans, int lossy, std::vector<uint8_t>& out)
+{
+    const uint32_t far = UINT32_MAX;
+    uint32_t threshold = lossy_threshold(lossy);
+    int ncolors = std::min(1 << lzw_min, 256); // indices are bytes
+
+    // distances between all index pairs; indices outside of the palette only match themselves
+    std::vector<uint32_t> dist(ncolors * ncolors, far);
+
+    for (int a = 0; a < ncolors; ++a)
+    {
+        for (int b = 0; b < ncolors; ++b)
+        {
+            if (a == b)
+            {
+                dist[a * ncolors + b] = 0;
+            }
+            else if (a < int(palette.size()) && b < int(palette.size()) && a != trans && b != trans)
+            {
+                dist[a * ncolors + b] = color_distance(palette[a], palette[b]);
+            }
+        }
+    }
+
+    // the trie: first child and next sibling of each code, and the last index of its string
+    int16_t first_child[0x1000];
+    int16_t next_sibling[0x1000];
+    uint8_t suffix[0x1000];
+
+    LZWWriter writer(lzw_min, out);
+
+    auto clear_trie = [&]()
+    {
+        std::fill(first_child, first_child + ncolors, -1);
+    };
+
+    clear_trie();
+
+    size_t i = 0;
+
+    while (i < n)
+    {
+        int node = indices[i];
+        size_t j = i + 1;
+
+        for (; j < n; ++j)
+        {
+            const uint32_t* d = &dist[indices[j]];
+            int best = -1;
+            uint32_t best_dist = threshold;
+
+            for (int c = first_child[node]; c >= 0; c = next_sibling[c])
+            {
+                uint32_t cd = d[suffix[c] * ncolors];
+
+                if (cd <= best_dist && (best < 0 || cd < best_dist))
+                {
+                    best = c;
+                    best_dist = cd;
+
+                    if (cd == 0)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            if (best < 0)
+            {
+                break;
+            }
+
+            node = best;
+        }
+
+        writer.write(node);
+
+        if (j < n)
+        {
+            int code = writer.next();
+
+            if (code < 0x1000)
+            {
+                suffix[code] = indices[j];
+                first_child[code] = -1;
+                next_sibling[code] = first_child[node];
+                first_child[node] = code;
+                writer.add_entry();
+            }
+            else
+            {
+                writer.clear();
+                clear_trie();
+            }
+        }
+        else
+        {
+            writer.add_entry();
+        }
+
+        i = j;
+    }
+
+    writer.finish();
+}
+
+/*
+Recompress every frame with lzw_encode_lossy() using its own color table; the pixels that change
+can be told apart from the original only by their color.
+*/
+inline void lossy_gif(const GIF& gif, int lossy, std::vector<uint8_t>& out, RecompressStats* stats = nullptr,
+                      int threads = std::max(1u, std::thread::hardware_concurrency()))
+{
+    recompress_gif(gif, out, stats, threads, [&](size_t f, const std::vector<uint8_t>& indices, int, std::vector<uint8_t>& data)
+    {
+        const Frame& frame = gif.frames[f];
+        const Image* img = frame.image;
+
+        lzw_encode_lossy(indices.data(), indices.size(), img->lzw_min, img->ct, frame.transparent ? frame.trans_idx : -1, lossy, data);
+    });
+}
+
+#endif
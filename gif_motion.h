@@ -0,0 +1,152 @@
+/*
+Motion and scene change analysis
+
+Only the part of the canvas a frame can change is compared with the canvas before it: the frame's
+rectangle plus whatever the disposal of the previous frame cleared or restored. Everything else
+is known to be unchanged without looking at it. The comparison runs 4 pixels at a time (SSE2).
+*/
+
+#ifndef GIF_MOTION_H
+#define GIF_MOTION_H
+
+#include "gif.h"
+#include "gif_canvas.h"
+
+#include <cstdlib>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct FrameMotion
+{
+    size_t frame;
+    float changed; // share of the canvas pixels that changed (0 - 1)
+    float difference; // mean absolute difference of all channels over the whole canvas (0 - 1)
+    Rect rect; // bounding rectangle of the changed pixels
+    bool scene_cut;
+};
+
+/* Number of pixels that differ between a and b and the sum of absolute differences of their bytes */
+inline void diff_row(const uint32_t* a, const uint32_t* b, size_t n, size_t& changed, uint64_t& sad)
+{
+    size_t x = 0;
+
+#ifdef __SSE2__
+    __m128i sum = _mm_setzero_si128();
+
+    for (; x + 4 <= n; x += 4)
+    {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+        int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+
+        changed += 4 - ((same & 1) + ((same >> 1) & 1) + ((same >> 2) & 1) + (same >> 3));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+    }
+
+    sad += uint64_t(_mm_cvtsi128_si32(sum)) + uint64_t(_mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+#endif
+
+    for (; x < n; ++x)
+    {
+        changed += a[x] != b[x];
+
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            sad += std::abs(int((a[x] >> shift) & 0xFF) - int((b[x] >> shift) & 0xFF));
+        }
+    }
+}
+
+/*
+Composite every frame and measure how much of the canvas it changed. A frame is a scene cut if it
+changes at least cut_changed of the canvas with a mean difference of at least cut_difference (so
+dithering noise over the whole frame doesn't count).
+*/
+inline void analyze_motion(const GIF& gif, std::vector<FrameMotion>& motion, float cut_changed = 0.5f, float cut_difference = 0.12f)
+{
+    Canvas canvas(gif);
+    std::vector<uint32_t> prev = canvas.pixels; // canvas after the previous frame
+    Rect screen = canvas.roi;
+    Rect disposed{0, 0, 0, 0}; // what the disposal of the previous frame can change
+    double total = double(screen.width) * screen.height;
+
+    motion.clear();
+
+    for (size_t i = 0; i < gif.frames.size(); ++i)
+    {
+        const Frame& f = gif.frames[i];
+        Rect r = intersect(bounding_rect(frame_rect(f), disposed), screen);
+        size_t changed = 0;
+        uint64_t sad = 0;
+        int x0 = screen.width, y0 = screen.height, x1 = -1, y1 = -1;
+
+        canvas.draw(f);
+
+        for (int y = r.top; y < r.bottom(); ++y)
+        {
+            size_t row = size_t(y) * screen.width + r.left;
+            size_t before = changed;
+
+            diff_row(&prev[row], &canvas.pixels[row], r.width, changed, sad);
+
+            if (changed != before)
+            {
+                // the row has changes, find where they start and end
+                int left = 0, right = r.width - 1;
+
+                while (prev[row + left] == canvas.pixels[row + left])
+                {
+                    left++;
+                }
+
+                while (prev[row + right] == canvas.pixels[row + right])
+                {
+                    right--;
+                }
+
+                x0 = std::min(x0, r.left + left);
+                x1 = std::max(x1, r.left + right);
+                y0 = std::min(y0, y);
+                y1 = y;
+
+                std::copy(&canvas.pixels[row + left], &canvas.pixels[row + right + 1], &prev[row + left]);
+            }
+        }
+
+        FrameMotion m;
+        m.frame = i;
+        m.changed = float(changed / total);
+        m.difference = float(sad / (total * 4 * 255));
+        m.rect = x1 < 0 ? Rect{0, 0, 0, 0} : Rect{x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+        m.scene_cut = i > 0 && m.changed >= cut_changed && m.difference >= cut_difference;
+
+        motion.push_back(m);
+        disposed = f.disposal_method >= 2 ? frame_rect(f) : Rect{0, 0, 0, 0};
+    }
+}
+
+/* Middle frame of the longest stretch between scene cuts, a good thumbnail */
+inline size_t representative_frame(const std::vector<FrameMotion>& motion)
+{
+    size_t best = 0, best_length = 0, start = 0;
+
+    for (size_t i = 0; i <= motion.size(); ++i)
+    {
+        if (i == motion.size() || (i > 0 && motion[i].scene_cut))
+        {
+            if (i - start > best_length)
+            {
+                best_length = i - start;
+                best = start + (i - start) / 2;
+            }
+
+            start = i;
+        }
+    }
+
+    return best;
+}
+
+#endif
@@ -0,0 +1,199 @@
+/*
+High effort LZW encoding: choose where to clear the string table to make the image data smallest
+
+The plain encoder clears the table whenever it fills up. Here the indices are cut into segments
+at up to max_candidates evenly spaced positions, and the size of every segment that starts
+with a fresh table is measured by running the encoder over it without writing anything (a table
+that fills up is kept as it is until the segment ends). Dynamic programming then picks the
+cheapest chain of segments. Segments starting at different positions are measured on several
+threads, and whole animations are recompressed one frame per thread.
+
+A measurement stops once the table has been full for as long as it took to fill it, longer
+segments hardly ever pay off.
+*/
+
+#ifndef GIF_OPTIMAL_H
+#define GIF_OPTIMAL_H
+
+#include "gif.h"
+#include "gif_encode.h"
+#include "gif_recompress.h"
+
+#include <atomic>
+#include <thread>
+
+/*
+Bits it takes to encode indices[cuts[first]] up to each of the following cuts with a fresh
+string table, including the code that ends it (a clear code or EOI). bits[j] is for the segment
+ending at cuts[first + 1 + j].
+*/
+inline void lzw_segment_bits(const uint8_t* indices, const std::vector<size_t>& cuts, size_t first, int lzw_min, LZWTable& table, std::vector<uint32_t>& bits)
+{
+    int eoi_code = (1 << lzw_min) + 1;
+    int code_size = lzw_min + 1;
+    int next_code = eoi_code + 1;
+    uint32_t total = 0;
+    size_t start = cuts[first];
+    size_t full_at = 0; // where the table filled up
+
+    table.clear();
+    bits.clear();
+
+    int prefix = indices[start];
+    size_t next = first + 1; // next cut
+
+    for (size_t i = start + 1; ; ++i)
+    {
+        if (i == cuts[next])
+        {
+            // write the prefix, the decoder adds an entry for it, then the clear code or EOI
+            int end_size = code_size;
+
+            if (next_code < 0x1000 && next_code + 1 > (1 << code_size) && code_size < 12)
+            {
+                end_size++;
+            }
+
+            bits.push_back(total + code_size + end_size);
+
+            if (++next == cuts.size() || (full_at > 0 && i - full_at > full_at - start))
+            {
+                break;
+            }
+        }
+
+        int k = indices[i];
+        size_t slot;
+        int code = table.find(prefix, k, slot);
+
+        if (code >= 0)
+        {
+            prefix = code;
+            continue;
+        }
+
+        total += code_size;
+
+        if (next_code < 0x1000)
+        {
+            table.insert(slot, prefix, k, next_code);
+            next_code++;
+
+            if (next_code > (1 << code_size) && code_size < 12)
+            {
+                code_size++;
+            }
+        }
+        else if (full_at == 0)
+        {
+            full_at = i;
+        }
+
+        prefix = k;
+    }
+}
+
+/*
+lzw_encode() with the clear codes placed by dynamic programming over up to max_candidates cut
+positions, on up to threads threads. The result is never bigger than lzw_encode()'s, which is
+used if the search can't beat it.
+*/
+inline void lzw_encode_optimal(const uint8_t* indices, size_t n, int lzw_min, std::vector<uint8_t>& out,
+                               int threads = 1, size_t max_candidates = 128)
+{
+    std::vector<uint8_t> plain;
+    lzw_encode(indices, n, lzw_min, plain);
+
+    if (n < 2)
+    {
+        out.insert(out.end(), plain.begin(), plain.end());
+        return;
+    }
+
+    std::vector<size_t> cuts; // candidate positions, 0 and n included
+
+    size_t step = std::max<size_t>(n / std::max<size_t>(max_candidates, 1), 64);
+
+    for (size_t i = 0; i < n; i += step)
+    {
+        cuts.push_back(i);
+    }
+
+    cuts.push_back(n);
+
+    // bits[i][j]: segment from cuts[i] to cuts[i + 1 + j]
+    std::vector<std::vector<uint32_t>> bits(cuts.size() - 1);
+    std::atomic<size_t> next_start(0);
+
+    auto measure = [&]()
+    {
+        LZWTable table;
+
+        for (size_t i = next_start++; i < bits.size(); i = next_start++)
+        {
+            lzw_segment_bits(indices, cuts, i, lzw_min, table, bits[i]);
+        }
+    };
+
+    std::vector<std::thread> workers;
+
+    for (int t = 1; t < std::min<int>(threads, bits.size()); ++t)
+    {
+        workers.emplace_back(measure);
+    }
+
+    measure();
+
+    for (auto& w : workers)
+    {
+        w.join();
+    }
+
+    // best[j]: fewest bits up to cuts[j], from[j]: where its last segment starts
+    std::vector<uint64_t> best(cuts.size(), UINT64_MAX);
+    std::vector<size_t> from(cuts.size(), 0);
+
+    best[0] = lzw_min + 1; // the clear code the stream starts with
+
+    for (size_t i = 0; i + 1 < cuts.size(); ++i)
+    {
+        for (size_t j = 0; j < bits[i].size(); ++j)
+        {
+            uint64_t b = best[i] + bits[i][j];
+
+            if (b < best[i + 1 + j])
+            {
+                best[i + 1 + j] = b;
+                from[i + 1 + j] = i;
+            }
+        }
+    }
+
+    // every segment can reach at least the next cut, so there's always a chain
+    std::vector<size_t> clear_at;
+
+    for (size_t j = from.back(); j > 0; j = from[j])
+    {
+        clear_at.push_back(cuts[j]);
+    }
+
+    std::reverse(clear_at.begin(), clear_at.end());
+
+    std::vector<uint8_t> optimal;
+    lzw_encode(indices, n, lzw_min, optimal, &clear_at);
+
+    const std::vector<uint8_t>& smaller = optimal.size() < plain.size() ? optimal : plain;
+    out.insert(out.end(), smaller.begin(), smaller.end());
+}
+
+/* Recompress every frame with lzw_encode_optimal(), without changing a single pixel */
+inline void optimize_gif(const GIF& gif, std::vector<uint8_t>& out, RecompressStats* stats = nullptr,
+                         size_t max_candidates = 128, int threads = std::max(1u, std::thread::hardware_concurrency()))
+{
+    recompress_gif(gif, out, stats, threads, [&](size_t f, const std::vector<uint8_t>& indices, int frame_threads, std::vector<uint8_t>& data)
+    {
+        lzw_encode_optimal(indices.data(), indices.size(), gif.frames[f].image->lzw_min, data, frame_threads, max_candidates);
+    });
+}
+
+#endif
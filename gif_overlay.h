@@ -0,0 +1,395 @@
+/*
+Overlays (logos, watermarks) stamped onto every frame of an animation
+
+The overlay is converted to premultiplied BGRA once, so blending it onto a canvas is a multiply
+and an add per channel, and only the rows and columns under its rectangle are touched.
+*/
+
+#ifndef GIF_OVERLAY_H
+#define GIF_OVERLAY_H
+
+#include "gif.h"
+#include "gif_canvas.h"
+#include "gif_encode.h"
+#include "gif_queue.h"
+
+#include <thread>
+#include <unordered_map>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* x / 255 rounded, for x up to 255 * 255 */
+inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+/* dst = src + dst * (1 - src alpha) for n premultiplied BGRA pixels */
+inline void blend_row(uint32_t* dst, const uint32_t* src, size_t n)
+{
+    size_t x = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i half = _mm_set1_epi16(128);
+
+    auto scale = [&](__m128i d, __m128i s) // d * (255 - alpha of s) / 255 for two pixels in 16 bit lanes
+    {
+        __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+        __m128i t = _mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(full, a)), half);
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    };
+
+    for (; x + 4 <= n; x += 4)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + x));
+
+        __m128i lo = scale(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+        __m128i hi = scale(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+    }
+#endif
+
+    for (; x < n; ++x)
+    {
+        uint32_t s = src[x];
+        uint32_t d = dst[x];
+        uint32_t k = 255 - (s >> 24);
+        uint32_t out = 0;
+
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            uint32_t c = ((s >> shift) & 0xFF) + div255(((d >> shift) & 0xFF) * k);
+            out |= std::min<uint32_t>(c, 255) << shift;
+        }
+
+        dst[x] = out;
+    }
+}
+
+class Overlay
+{
+public:
+    /* Use width x height straight alpha BGRA pixels placed at left, top; opacity scales their alpha */
+    void set(const uint32_t* bgra, int width, int height, int left, int top, float opacity = 1)
+    {
+        rect = Rect{left, top, width, height};
+        pixels.resize(size_t(width) * height);
+
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            uint32_t p = bgra[i];
+            uint32_t a = uint32_t((p >> 24) * opacity + 0.5f);
+
+            pixels[i] = color_rgba(div255(((p >> 16) & 0xFF) * a), div255(((p >> 8) & 0xFF) * a), div255((p & 0xFF) * a), a);
+        }
+    }
+
+    /* Use the first frame of gif (its own rectangle, transparent pixels left out); it stays decoded */
+    bool load(GIF& gif, int left, int top, float opacity = 1)
+    {
+        if (gif.frames.empty())
+        {
+            return false;
+        }
+
+        const Frame& f = gif.frames[0];
+        Image& img = *f.image;
+        std::vector<uint32_t> bgra(img.width * img.height);
+
+        decode_image(gif, img);
+
+        for (size_t i = 0; i < bgra.size(); ++i)
+        {
+            int index = img.index[i];
+            Color c = index < int(img.ct.size()) ? img.ct[index] : Color{0, 0, 0};
+
+            bgra[i] = color_rgba(c.r, c.g, c.b, f.transparent && index == f.trans_idx ? 0 : 255);
+        }
+
+        set(bgra.data(), img.width, img.height, left, top, opacity);
+        return true;
+    }
+
+    /* Blend onto pixels, which cover area (a rectangle of the logical screen) */
+    void blend(uint32_t* dst, const Rect& area) const
+    {
+        Rect r = intersect(rect, area);
+
+        for (int y = r.top; y < r.bottom(); ++y)
+        {
+            blend_row(dst + size_t(y - area.top) * area.width + (r.left - area.left),
+                      &pixels[size_t(y - rect.top) * rect.width + (r.left - rect.left)], r.width);
+        }
+    }
+
+    Rect rect{0, 0, 0, 0}; // where the overlay goes on the logical screen
+    std::vector<uint32_t> pixels; // premultiplied BGRA
+};
+
+struct OverlayStats
+{
+    size_t frames_copied = 0;
+    size_t frames_stamped = 0; // re-encoded with the overlay on top
+};
+
+/*
+Stamp overlay onto every frame of gif and write the result to out. Frames that don't touch the
+overlay's rectangle are copied as they are. The others are re-encoded as the difference between
+what's on screen before and after them with the overlay blended on top, both taken from a canvas
+of the original animation. The colors of that difference go into the frame's own color table:
+exact matches are reused and new colors take the table's unused slots (a table grows up to 256
+entries for that); if they don't fit, the changed pixels are quantized instead. Re-encoded frames
+are not disposed of, so like in edit_gif() the frame after one whose original disposal method was
+2 or 3 is re-encoded too. While a frame is blended and encoded, a thread decodes the next ones into
+their Image::index, which is freed again once the frame is written.
+*/
+inline void overlay_gif(GIF& gif, const Overlay& overlay, std::vector<uint8_t>& out, OverlayStats* stats = nullptr)
+{
+    OverlayStats s;
+    Canvas canvas(gif);
+    Rect screen = canvas.roi;
+
+    copy_header(out, gif, 13 + (gif.gct_flag ? 3 * gif.gct.size() : 0));
+
+    const GIFBlock* gc = nullptr; // graphic control extension waiting for its image
+    size_t frame = 0;
+    bool in_sync = true; // the canvas before the next frame is the original one with the overlay on top
+    bool stamped = false; // the overlay is on screen (not before the first frame)
+    Rect disposed{0, 0, 0, 0}; // what the original disposal of the last re-encoded frame would have changed
+    BoundedQueue<size_t> decoded(2); // frames decoded ahead by decode_thread
+    std::vector<uint32_t> before, after;
+    std::vector<uint8_t> indices;
+
+    // copy region r of the canvas into pixels and blend the overlay on top
+    auto grab = [&](const Rect& r, std::vector<uint32_t>& pixels, bool blend)
+    {
+        pixels.resize(size_t(r.width) * r.height);
+
+        for (int y = 0; y < r.height; ++y)
+        {
+            const uint32_t* src = &canvas.pixels[size_t(r.top + y) * screen.width + r.left];
+            std::copy(src, src + r.width, &pixels[size_t(y) * r.width]);
+        }
+
+        if (blend)
+        {
+            overlay.blend(pixels.data(), r);
+        }
+    };
+
+    std::thread decode_thread([&]()
+    {
+        for (size_t i = 0; i < gif.frames.size(); ++i)
+        {
+            decode_image(gif, *gif.frames[i].image);
+
+            if (!decoded.push(size_t(i)))
+            {
+                break;
+            }
+        }
+
+        decoded.close();
+    });
+
+    for (auto& block : gif.blocks)
+    {
+        if (block->type == BT_GRAPHIC_CONTROL)
+        {
+            gc = block.get();
+            continue;
+        }
+
+        if (block->type != BT_IMAGE)
+        {
+            if (is_plain_text(block.get()) && gc != nullptr)
+            {
+                copy_block(out, gif, gc);
+                gc = nullptr;
+            }
+
+            copy_block(out, gif, block.get());
+            continue;
+        }
+
+        const Frame& f = gif.frames[frame];
+        Image* img = f.image;
+        Rect fr = intersect(frame_rect(f), screen);
+
+        size_t ready;
+        decoded.pop(ready); // frames come in order, so this is the current one
+
+        if (in_sync && stamped && intersect(fr, overlay.rect).empty())
+        {
+            canvas.draw(f);
+
+            if (gc != nullptr)
+            {
+                copy_block(out, gif, gc);
+            }
+
+            copy_block(out, gif, img);
+            in_sync = true;
+            disposed = Rect{0, 0, 0, 0};
+            s.frames_copied++;
+        }
+        else
+        {
+            if (in_sync)
+            {
+                canvas.dispose(); // a copied frame gets disposed of by the viewer as well
+            }
+
+            Rect r = intersect(bounding_rect(bounding_rect(fr, disposed), stamped ? Rect{0, 0, 0, 0} : overlay.rect), screen);
+
+            grab(r, before, stamped);
+            canvas.draw(f);
+            grab(r, after, true);
+
+            // shrink to the pixels that change
+            int x0 = r.width, y0 = r.height, x1 = -1, y1 = -1;
+
+            for (int y = 0; y < r.height; ++y)
+            {
+                for (int x = 0; x < r.width; ++x)
+                {
+                    if (before[size_t(y) * r.width + x] != after[size_t(y) * r.width + x])
+                    {
+                        x0 = std::min(x0, x);
+                        x1 = std::max(x1, x);
+                        y0 = std::min(y0, y);
+                        y1 = y;
+                    }
+                }
+            }
+
+            Rect d = x1 < 0 ? Rect{r.left, r.top, 1, 1} // nothing changes, keep the frame for its delay time
+                            : Rect{r.left + x0, r.top + y0, x1 - x0 + 1, y1 - y0 + 1};
+
+            // palette: the frame's colors, then new ones in the free slots
+            std::vector<Color> palette = img->ct;
+            std::unordered_map<uint32_t, int> lookup;
+            int trans = f.transparent ? f.trans_idx : palette.size() < 256 ? int(palette.size()) : -1;
+            size_t ncolors = std::max<size_t>(palette.size(), trans + 1);
+            size_t free_slot = palette.size();
+
+            palette.resize(256, Color{0, 0, 0});
+
+            for (int i = 0; i < int(img->ct.size()); ++i)
+            {
+                uint32_t key = color_rgba(palette[i].r, palette[i].g, palette[i].b, 255);
+
+                if (i != trans && lookup.count(key) == 0)
+                {
+                    lookup[key] = i;
+                }
+            }
+
+            indices.resize(size_t(d.width) * d.height);
+
+            auto map_colors = [&]()
+            {
+                for (int y = 0; y < d.height; ++y)
+                {
+                    for (int x = 0; x < d.width; ++x)
+                    {
+                        size_t i = size_t(d.top - r.top + y) * r.width + (d.left - r.left + x);
+                        uint32_t p = after[i];
+                        uint8_t& index = indices[size_t(y) * d.width + x];
+
+                        if (trans >= 0 && before[i] == p)
+                        {
+                            index = trans;
+                            continue;
+                        }
+
+                        auto it = lookup.find(p);
+
+                        if (it != lookup.end())
+                        {
+                            index = it->second;
+                            continue;
+                        }
+
+                        if (free_slot == size_t(trans))
+                        {
+                            free_slot++;
+                        }
+
+                        if (free_slot >= 256)
+                        {
+                            return false;
+                        }
+
+                        palette[free_slot] = Color{uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p)};
+                        lookup[p] = index = free_slot++;
+                        ncolors = std::max(ncolors, free_slot);
+                    }
+                }
+
+                return true;
+            };
+
+            if (!map_colors())
+            {
+                // too many new colors (e.g. a blended overlay on a full table): quantize the changed pixels
+                std::vector<uint32_t> changed(indices.size());
+
+                for (int y = 0; y < d.height; ++y)
+                {
+                    std::copy_n(&after[size_t(d.top - r.top + y) * r.width + (d.left - r.left)], d.width, &changed[size_t(y) * d.width]);
+                }
+
+                quantize(changed.data(), changed.size(), 255, palette, indices);
+                trans = palette.size();
+                ncolors = palette.size() + 1;
+
+                for (int y = 0; y < d.height; ++y)
+                {
+                    for (int x = 0; x < d.width; ++x)
+                    {
+                        size_t i = size_t(d.top - r.top + y) * r.width + (d.left - r.left + x);
+
+                        if (before[i] == after[i])
+                        {
+                            indices[size_t(y) * d.width + x] = trans;
+                        }
+                    }
+                }
+            }
+
+            palette.resize(size_t(2) << color_table_size(ncolors));
+
+            write_graphics_control(out, 1, f.delay_time, trans >= 0, trans >= 0 ? trans : 0);
+            write_image(out, d.left, d.top, d.width, d.height, palette, indices.data(), palette.size());
+
+            in_sync = f.disposal_method <= 1;
+            disposed = in_sync ? Rect{0, 0, 0, 0} : fr;
+            stamped = true;
+            s.frames_stamped++;
+        }
+
+        std::vector<uint8_t>().swap(img->index); // only the few frames ahead are kept decoded
+        gc = nullptr;
+        frame++;
+    }
+
+    decoded.close();
+    decode_thread.join();
+
+    out.push_back(0x3B); // trailer
+
+    if (stats != nullptr)
+    {
+        *stats = s;
+    }
+}
+
+#endif
@@ -0,0 +1,233 @@
+/*
+Global color table planning: which frames can share one palette and which need their own
+
+Every frame is sampled (on several threads) into a sparse 15-bit color histogram that also keeps
+the mean color of each bin, and the histograms are added up into one for the whole animation.
+median_cut() turns that into the global palette, whose entries are then moved to the mean of the
+colors closest to them, so colors that are in the frames come out exactly. A frame gets a local
+color table only if the error the global palette leaves in it, less what its own palette would
+leave, is worth the bytes of an extra color table.
+*/
+
+#ifndef GIF_PALETTE_H
+#define GIF_PALETTE_H
+
+#include "gif.h"
+#include "gif_encode.h"
+#include "gif_parallel.h"
+
+#include <thread>
+
+/* Sampled pixels that fall into one 15-bit histogram bin */
+struct ColorBin
+{
+    uint16_t key;
+    uint32_t count;
+    uint32_t sum[3]; // r, g, b
+
+    Color mean() const { return Color{uint8_t(sum[0] / count), uint8_t(sum[1] / count), uint8_t(sum[2] / count)}; }
+};
+
+struct PalettePlan
+{
+    std::vector<Color> global; // at most 255 colors, so that there's an index left for transparency
+    std::vector<char> local; // per frame: true if it should get its own color table
+    std::vector<float> global_error; // per frame: mean color_distance() to the global palette (sampled)
+    std::vector<float> local_error; // the same for its own palette, only for frames that are worth checking
+};
+
+/* Nearest palette entry of each bin (by its mean color) and the mean color_distance() to it */
+inline float palette_error(const std::vector<ColorBin>& bins, const std::vector<Color>& palette, std::vector<uint8_t>& nearest)
+{
+    uint64_t sum = 0, count = 0;
+
+    nearest.resize(bins.size());
+
+    for (size_t i = 0; i < bins.size(); ++i)
+    {
+        Color c = bins[i].mean();
+
+        nearest[i] = nearest_color(palette, c);
+        sum += uint64_t(color_distance(c, palette[nearest[i]])) * bins[i].count;
+        count += bins[i].count;
+    }
+
+    return count == 0 ? 0 : float(double(sum) / count);
+}
+
+/* Median cut of the bins, then move every entry to the mean of the bins nearest to it */
+inline std::vector<Color> bin_palette(const std::vector<ColorBin>& bins, int max_colors, std::vector<uint32_t>& histogram)
+{
+    for (auto& bin : bins)
+    {
+        histogram[bin.key] = bin.count;
+    }
+
+    std::vector<Color> palette = median_cut(histogram, max_colors);
+
+    for (auto& bin : bins)
+    {
+        histogram[bin.key] = 0; // the caller's buffer is left cleared
+    }
+
+    std::vector<uint8_t> nearest;
+    std::vector<uint64_t> sums(palette.size() * 4, 0);
+
+    palette_error(bins, palette, nearest);
+
+    for (size_t i = 0; i < bins.size(); ++i)
+    {
+        uint64_t* s = &sums[nearest[i] * 4];
+
+        for (int c = 0; c < 3; ++c)
+        {
+            s[c] += bins[i].sum[c];
+        }
+
+        s[3] += bins[i].count;
+    }
+
+    for (size_t j = 0; j < palette.size(); ++j)
+    {
+        const uint64_t* s = &sums[j * 4];
+
+        if (s[3] > 0)
+        {
+            palette[j] = Color{uint8_t(s[0] / s[3]), uint8_t(s[1] / s[3]), uint8_t(s[2] / s[3])};
+        }
+    }
+
+    return palette;
+}
+
+/*
+Plan the color tables of nframes frames of npixels BGRA pixels each. About samples pixels of each
+frame are looked at. lambda is how many bytes a pixel's share of one unit of error is worth: a
+frame gets its own table if (global error - local error) * npixels * lambda is more than the size
+of the table. Frames whose global error is below min_error always use the global palette.
+*/
+inline void plan_palette(const std::vector<const uint32_t*>& frames, size_t npixels, PalettePlan& plan,
+                         float lambda = 0.003f, float min_error = 4, size_t samples = 4096)
+{
+    size_t nframes = frames.size();
+    size_t step = std::max<size_t>(1, npixels / samples);
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::vector<ColorBin>> bins(nframes); // sparse histogram of each frame
+
+    plan.local.assign(nframes, 0);
+    plan.global_error.assign(nframes, 0);
+    plan.local_error.assign(nframes, 0);
+
+    // where each bin is in the frame's list, per thread
+    parallel_rows(nframes, npixels / step, threads, [&](size_t first, size_t end)
+    {
+        std::vector<int32_t> slot(0x8000, -1);
+
+        for (size_t f = first; f < end; ++f)
+        {
+            for (size_t i = 0; i < npixels; i += step)
+            {
+                uint32_t p = frames[f][i];
+                int key = color_key15(p);
+
+                if (slot[key] < 0)
+                {
+                    slot[key] = bins[f].size();
+                    bins[f].push_back(ColorBin{uint16_t(key), 0, {0, 0, 0}});
+                }
+
+                ColorBin& bin = bins[f][slot[key]];
+                bin.count++;
+                bin.sum[0] += (p >> 16) & 0xFF;
+                bin.sum[1] += (p >> 8) & 0xFF;
+                bin.sum[2] += p & 0xFF;
+            }
+
+            for (auto& bin : bins[f])
+            {
+                slot[bin.key] = -1;
+            }
+        }
+    });
+
+    // all frames together, with the sums scaled down so that they can't overflow
+    std::vector<uint64_t> total(0x8000 * 4, 0);
+    std::vector<ColorBin> all;
+
+    for (auto& b : bins)
+    {
+        for (auto& bin : b)
+        {
+            uint64_t* t = &total[bin.key * 4];
+
+            for (int c = 0; c < 3; ++c)
+            {
+                t[c] += bin.sum[c];
+            }
+
+            t[3] += bin.count;
+        }
+    }
+
+    for (int key = 0; key < 0x8000; ++key)
+    {
+        const uint64_t* t = &total[key * 4];
+
+        if (t[3] > 0)
+        {
+            uint64_t scale = t[3] / 0x10000 + 1;
+            uint32_t count = t[3] / scale;
+            all.push_back(ColorBin{uint16_t(key), count, {uint32_t(t[0] / t[3] * count), uint32_t(t[1] / t[3] * count), uint32_t(t[2] / t[3] * count)}});
+        }
+    }
+
+    std::vector<uint32_t> histogram(0x8000, 0);
+    plan.global = bin_palette(all, 255, histogram);
+
+    if (plan.global.empty())
+    {
+        return;
+    }
+
+    // nearest global entry of every bin that occurs, shared by all frames
+    std::vector<uint8_t> all_nearest;
+    std::vector<uint8_t> nearest_global(0x8000, 0);
+
+    palette_error(all, plan.global, all_nearest);
+
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        nearest_global[all[i].key] = all_nearest[i];
+    }
+
+    size_t table_bytes = 3 * (size_t(2) << color_table_size(256));
+
+    parallel_rows(nframes, npixels / step, threads, [&](size_t first, size_t end)
+    {
+        std::vector<uint32_t> histogram(0x8000, 0);
+        std::vector<uint8_t> nearest;
+
+        for (size_t f = first; f < end; ++f)
+        {
+            uint64_t sum = 0;
+
+            for (auto& bin : bins[f])
+            {
+                sum += uint64_t(color_distance(bin.mean(), plan.global[nearest_global[bin.key]])) * bin.count;
+            }
+
+            plan.global_error[f] = bins[f].empty() ? 0 : float(double(sum) / ((npixels + step - 1) / step));
+            plan.local_error[f] = plan.global_error[f];
+
+            if (plan.global_error[f] < min_error || plan.global_error[f] * npixels * lambda < table_bytes)
+            {
+                continue; // not worth a table even if its own palette were perfect
+            }
+
+            plan.local_error[f] = palette_error(bins[f], bin_palette(bins[f], 256, histogram), nearest);
+            plan.local[f] = (plan.global_error[f] - plan.local_error[f]) * npixels * lambda > table_bytes;
+        }
+    });
+}
+
+#endif
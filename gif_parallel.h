@@ -0,0 +1,50 @@
+/*
+Splitting work on rows of pixels (or other items) among threads
+*/
+
+#ifndef GIF_PARALLEL_H
+#define GIF_PARALLEL_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+/*
+Run fn(first_row, end_row, band) over bands of [0, height) on up to threads threads. The band
+numbers go from 0 to threads - 1, so they can pick a scratch buffer of the thread's own. Small
+jobs run on the calling thread since starting threads would cost more than they save.
+*/
+template<typename Fn>
+void parallel_bands(size_t height, size_t width, int threads, Fn fn)
+{
+    size_t bands = std::min<size_t>(std::max(threads, 1), height);
+
+    if (bands <= 1 || width * height < 64 * 1024)
+    {
+        fn(size_t(0), height, size_t(0));
+        return;
+    }
+
+    std::vector<std::thread> workers;
+
+    for (size_t i = 1; i < bands; ++i)
+    {
+        workers.emplace_back(fn, height * i / bands, height * (i + 1) / bands, i);
+    }
+
+    fn(size_t(0), height / bands, size_t(0));
+
+    for (auto& w : workers)
+    {
+        w.join();
+    }
+}
+
+/* parallel_bands() for fn(first_row, end_row) */
+template<typename Fn>
+void parallel_rows(size_t height, size_t width, int threads, Fn fn)
+{
+    parallel_bands(height, width, threads, [&](size_t first, size_t end, size_t) { fn(first, end); });
+}
+
+#endif
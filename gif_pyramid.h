@@ -0,0 +1,120 @@
+/*
+Downscaled copies (1/2, 1/4, 1/8) of composited canvases, for showing a GIF at several sizes
+
+All levels come out of one pass over the frame: every two rows of a level are averaged into a row
+of the next one right after they were written, while they are still in cache. Averaging 2 x 2
+pixels is two rounds of _mm_avg_epu8 (SSE2 when available, the same rounding without).
+*/
+
+#ifndef GIF_PYRAMID_H
+#define GIF_PYRAMID_H
+
+#include "gif.h"
+#include "gif_canvas.h"
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Rounded up average of a and b for each of the four channels */
+inline uint32_t avg_pixel(uint32_t a, uint32_t b)
+{
+    return (a | b) - (((a ^ b) >> 1) & 0x7F7F7F7F);
+}
+
+/* Average 2 x 2 blocks of rows a and b (2 * width pixels each) into width pixels */
+inline void downsample_row(const uint32_t* a, const uint32_t* b, uint32_t* out, size_t width)
+{
+    size_t x = 0;
+
+#ifdef __SSE2__
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i v0 = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 2 * x)),
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 2 * x)));
+        __m128i v1 = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 2 * x + 4)),
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + 2 * x + 4)));
+
+        // even and odd pixels of the 8 vertical averages
+        __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(v0), _mm_castsi128_ps(v1), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(v0), _mm_castsi128_ps(v1), _MM_SHUFFLE(3, 1, 3, 1));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_avg_epu8(_mm_castps_si128(even), _mm_castps_si128(odd)));
+    }
+#endif
+
+    for (; x < width; ++x)
+    {
+        out[x] = avg_pixel(avg_pixel(a[2 * x], b[2 * x]), avg_pixel(a[2 * x + 1], b[2 * x + 1]));
+    }
+}
+
+/*
+Levels 1 - levels of a canvas, level n being 1/2^n of its size (rounded down, a last odd row or
+column is left out). The buffers are kept from one frame to the next.
+*/
+class Pyramid
+{
+public:
+    Pyramid(int levels_ = 3) : levels(std::min(std::max(levels_, 1), 3)) {}
+
+    void build(const uint32_t* pixels, size_t width, size_t height)
+    {
+        const uint32_t* src = pixels;
+        size_t src_width = width;
+
+        for (int n = 0; n < levels; ++n)
+        {
+            widths[n] = width >> (n + 1);
+            heights[n] = height >> (n + 1);
+            level[n].resize(widths[n] * heights[n]);
+        }
+
+        for (size_t y = 0; y < heights[0]; ++y)
+        {
+            downsample_row(src + 2 * y * src_width, src + (2 * y + 1) * src_width, &level[0][y * widths[0]], widths[0]);
+
+            // the row just finished may complete a row of the next levels
+            for (int n = 1; n < levels && (y + 1) % (size_t(1) << n) == 0; ++n)
+            {
+                size_t r = (y + 1) / (size_t(1) << n) - 1;
+
+                if (r < heights[n])
+                {
+                    const uint32_t* above = &level[n - 1][2 * r * widths[n - 1]];
+                    downsample_row(above, above + widths[n - 1], &level[n][r * widths[n]], widths[n]);
+                }
+            }
+        }
+    }
+
+    size_t width(int n) const { return widths[n - 1]; }
+    size_t height(int n) const { return heights[n - 1]; }
+    const std::vector<uint32_t>& pixels(int n) const { return level[n - 1]; }
+
+    int levels;
+
+private:
+    std::vector<uint32_t> level[3];
+    size_t widths[3] = {0, 0, 0};
+    size_t heights[3] = {0, 0, 0};
+};
+
+/* Composite every frame once and call frame_fn(frame_number, canvas, pyramid) with all its sizes */
+template<typename FrameFn>
+void decode_pyramid(const GIF& gif, int levels, FrameFn frame_fn)
+{
+    Canvas canvas(gif);
+    Pyramid pyramid(levels);
+
+    for (size_t i = 0; i < gif.frames.size(); ++i)
+    {
+        canvas.draw(gif.frames[i]);
+        pyramid.build(canvas.pixels.data(), canvas.width(), canvas.height());
+        frame_fn(i, canvas, pyramid);
+    }
+}
+
+#endif
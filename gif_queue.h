@@ -0,0 +1,74 @@
+/*
+Bounded queue between the threads of a pipeline
+
+push() waits while the queue is full and pop() while it's empty, so a fast stage can't run ahead
+of a slow one by more than the queue's capacity and memory use stays bounded.
+*/
+
+#ifndef GIF_QUEUE_H
+#define GIF_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template<typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t capacity_) : capacity(capacity_) {}
+
+    /* Wait for room and add item; false if the queue has been closed */
+    bool push(T&& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [&]() { return items.size() < capacity || closed; });
+
+        if (closed)
+        {
+            return false;
+        }
+
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+
+        return true;
+    }
+
+    /* Wait for an item and take it; false once the queue is closed and empty */
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [&]() { return !items.empty() || closed; });
+
+        if (items.empty())
+        {
+            return false;
+        }
+
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+
+        return true;
+    }
+
+    /* No more pushes; pop() still hands out what's left */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed = false;
+
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_empty, not_full;
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+Rate control: encode an animation into at most a given number of bytes
+
+The settings get worse along a fixed ladder of levels: fewer colors, then lower resolution, and
+dropping frames last, each level at least as lossy as the one before in all of them. Within a
+level, lossy LZW comes before the next level: the levels are tried in order at the highest lossy
+level until one fits, then a binary search finds the lowest lossy level that still fits there.
+Sizes don't always shrink from one level to the next (fewer colors can dither into a bigger file),
+so the levels are walked rather than searched. What encodes have in common is cached: the
+downscaled frames, and the compared and quantized frames of each level (see
+StreamEncoder::capture), so trying another lossy level just runs LZW again.
+*/
+
+#ifndef GIF_RATECONTROL_H
+#define GIF_RATECONTROL_H
+
+#include "gif.h"
+#include "gif_pyramid.h"
+#include "gif_stream.h"
+
+#include <map>
+#include <sstream>
+#include <tuple>
+
+struct RateLevel
+{
+    int scale; // 1, 2 or 4
+    int step; // keep every step-th frame
+    int colors; // per color table
+};
+
+const RateLevel rate_levels[] = {
+    {1, 1, 256}, {1, 1, 128}, {1, 1, 64}, {2, 1, 64}, {2, 1, 32}, {4, 1, 32}, {4, 2, 32}, {4, 3, 32}, {4, 4, 16}
+};
+
+const int rate_lossy[] = {0, 20, 40, 60, 80};
+
+struct RateStats
+{
+    size_t encodes = 0;
+    size_t prepares = 0; // encodes that had to compare and quantize frames, the others only ran LZW
+    size_t level = 0; // in rate_levels
+    int lossy = 0;
+    size_t bytes = 0;
+};
+
+class RateControl
+{
+public:
+    /* frames of width x height BGRA pixels, shown for delays[i] centiseconds each */
+    RateControl(const std::vector<std::vector<uint32_t>>& frames_, const std::vector<int>& delays_,
+                size_t width_, size_t height_, int loop_count_ = 0)
+        : frames(frames_), delays(delays_), width(width_), height(height_), loop_count(loop_count_)
+    {
+    }
+
+    /*
+    Encode with the best settings whose output has at most target bytes. If even the worst are
+    too big, out gets what they give and the result is false.
+    */
+    bool encode(size_t target, std::string& out, RateStats* stats = nullptr)
+    {
+        const size_t nlevels = sizeof(rate_levels) / sizeof(rate_levels[0]);
+        const size_t nlossy = sizeof(rate_lossy) / sizeof(rate_lossy[0]);
+
+        std::map<std::pair<size_t, int>, std::string> results; // by level and lossy level
+        RateStats s;
+
+        auto fits = [&](size_t level, size_t lossy)
+        {
+            std::string& bytes = results[std::make_pair(level, lossy_level(lossy))];
+
+            if (bytes.empty())
+            {
+                encode_level(rate_levels[level], lossy_level(lossy), bytes, s);
+            }
+
+            return !bytes.empty() && bytes.size() <= target;
+        };
+
+        size_t level = 0, lossy = 0;
+
+        if (!fits(0, 0))
+        {
+            // the first level that fits at the highest lossy level, or the last one
+            lossy = nlossy - 1;
+
+            while (level + 1 < nlevels && !fits(level, lossy))
+            {
+                level++;
+            }
+
+            // and the lowest lossy level that fits there: lo doesn't, hi does
+            if (level > 0 && fits(level, 0))
+            {
+                lossy = 0;
+            }
+            else if (fits(level, lossy))
+            {
+                size_t lo = 0, hi = nlossy - 1;
+
+                while (hi - lo > 1)
+                {
+                    size_t mid = (lo + hi) / 2;
+                    (fits(level, mid) ? hi : lo) = mid;
+                }
+
+                lossy = hi;
+            }
+        }
+
+        out.swap(results[std::make_pair(level, lossy_level(lossy))]);
+        s.level = level;
+        s.lossy = lossy_level(lossy);
+        s.bytes = out.size();
+
+        if (stats != nullptr)
+        {
+            *stats = s;
+        }
+
+        return !out.empty() && out.size() <= target;
+    }
+
+    int min_lossy = 0; // lossy levels of the ladder below it are raised to it
+    size_t optimize = 0; // see StreamEncoder::optimize, for the encodes without lossy LZW
+
+private:
+    int lossy_level(size_t i) const
+    {
+        return std::max(rate_lossy[i], min_lossy);
+    }
+
+    /* Output at one level and lossy level, left empty if the frames would be smaller than a pixel */
+    void encode_level(const RateLevel& r, int lossy, std::string& out, RateStats& s)
+    {
+        size_t w = width / r.scale, h = height / r.scale;
+
+        if (w == 0 || h == 0)
+        {
+            return;
+        }
+
+        const std::vector<StreamFrame>& cached = prepared(r, s);
+        std::ostringstream file;
+        StreamEncoder encoder(file, w, h, loop_count);
+
+        encoder.lossy = lossy;
+        encoder.optimize = optimize;
+
+        for (auto& f : cached)
+        {
+            encoder.push_prepared(f);
+        }
+
+        encoder.finish();
+        out = file.str();
+        s.encodes++;
+    }
+
+    /* Compared and quantized frames for the size, frame step and colors of r */
+    const std::vector<StreamFrame>& prepared(const RateLevel& r, RateStats& s)
+    {
+        auto key = std::make_tuple(r.scale, r.step, r.colors);
+        auto it = cache.find(key);
+
+        if (it != cache.end())
+        {
+            return it->second;
+        }
+
+        const std::vector<std::vector<uint32_t>>& source = scaled(r.scale);
+        std::vector<StreamFrame>& out = cache[key];
+        std::ostringstream discard;
+        StreamEncoder encoder(discard, width / r.scale, height / r.scale, loop_count);
+
+        encoder.max_colors = r.colors;
+        encoder.capture = &out;
+
+        for (size_t i = 0; i < source.size(); i += r.step)
+        {
+            int delay = 0;
+
+            for (size_t j = i; j < std::min(i + r.step, delays.size()); ++j)
+            {
+                delay += delays[j]; // the dropped frames' time goes to the one that's kept
+            }
+
+            encoder.push(source[i].data(), std::min(delay, 0xFFFF));
+        }
+
+        encoder.finish();
+        s.prepares++;
+
+        return out;
+    }
+
+    /* The frames at 1/scale of their size, downscaled once for all levels */
+    const std::vector<std::vector<uint32_t>>& scaled(int scale)
+    {
+        if (scale == 1)
+        {
+            return frames;
+        }
+
+        if (halves.empty())
+        {
+            Pyramid pyramid(2);
+
+            for (auto& f : frames)
+            {
+                pyramid.build(f.data(), width, height);
+                halves.push_back(pyramid.pixels(1));
+                quarters.push_back(pyramid.pixels(2));
+            }
+        }
+
+        return scale == 2 ? halves : quarters;
+    }
+
+    const std::vector<std::vector<uint32_t>>& frames;
+    const std::vector<int>& delays;
+    size_t width, height;
+    int loop_count;
+
+    std::vector<std::vector<uint32_t>> halves, quarters;
+    std::map<std::tuple<int, int, int>, std::vector<StreamFrame>> cache;
+};
+
+#endif
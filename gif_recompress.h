@@ -0,0 +1,115 @@
+/*
+Rewriting the image data of a whole file, frame by frame on several threads, while everything else
+is copied as it is (see optimize_gif() in gif_optimal.h and lossy_gif() in gif_lossy.h)
+*/
+
+#ifndef GIF_RECOMPRESS_H
+#define GIF_RECOMPRESS_H
+
+#include "gif.h"
+
+#include <atomic>
+#include <thread>
+
+struct RecompressStats
+{
+    size_t frames_recompressed = 0; // the others kept their image data
+    size_t bytes_before = 0; // image data only
+    size_t bytes_after = 0;
+};
+
+/*
+Replace the image data of every frame by encode_fn(frame_number, indices, threads, data), which
+appends new image data to data (or nothing to keep the old one). indices are in stream order, so
+interlaced images stay interlaced. Everything else is copied as it is, and so is image data that
+wouldn't get smaller. Frames are spread over the threads; if there are fewer frames than threads,
+encode_fn is told to use several of them.
+*/
+template<typename EncodeFn>
+void recompress_gif(const GIF& gif, std::vector<uint8_t>& out, RecompressStats* stats, int threads, EncodeFn encode_fn)
+{
+    RecompressStats s;
+    std::vector<std::vector<uint8_t>> data(gif.frames.size()); // new image data of each frame, empty to keep the old one
+    std::atomic<size_t> next_frame(0);
+    int frame_threads = std::max<int>(1, threads / std::max<size_t>(gif.frames.size(), 1));
+
+    auto compress = [&]()
+    {
+        std::vector<uint8_t> stream, indices;
+
+        for (size_t f = next_frame++; f < gif.frames.size(); f = next_frame++)
+        {
+            const Image* img = gif.frames[f].image;
+
+            stream.clear();
+            indices.resize(img->width * img->height);
+            read_sub_blocks(gif.bytes, img->data_offset, stream);
+
+            size_t rows = lzw_decode(stream.data(), stream.size(), img->lzw_min, img->width, img->height, [&](size_t y, const uint8_t* row)
+            {
+                std::copy(row, row + img->width, &indices[y * img->width]);
+            });
+
+            if (rows == img->height)
+            {
+                encode_fn(f, indices, frame_threads, data[f]);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+
+    for (int t = 1; t < std::min<int>(threads, gif.frames.size()); ++t)
+    {
+        workers.emplace_back(compress);
+    }
+
+    compress();
+
+    for (auto& w : workers)
+    {
+        w.join();
+    }
+
+    copy_header(out, gif, 13 + (gif.gct_flag ? 3 * gif.gct.size() : 0));
+
+    size_t frame = 0;
+
+    for (auto& block : gif.blocks)
+    {
+        if (block->type != BT_IMAGE)
+        {
+            copy_block(out, gif, block.get());
+            continue;
+        }
+
+        const Image* img = static_cast<const Image*>(block.get());
+        size_t old_size = img->offset + img->length - (img->data_offset - 1);
+
+        s.bytes_before += old_size;
+
+        if (data[frame].empty() || data[frame].size() >= old_size)
+        {
+            copy_block(out, gif, img);
+            s.bytes_after += old_size;
+        }
+        else
+        {
+            out.insert(out.end(), gif.bytes.begin() + img->offset, gif.bytes.begin() + img->data_offset - 1); // descriptor and color table
+            out.insert(out.end(), data[frame].begin(), data[frame].end());
+            s.bytes_after += data[frame].size();
+            s.frames_recompressed++;
+        }
+
+        frame++;
+    }
+
+    out.push_back(0x3B); // trailer
+
+    if (stats != nullptr)
+    {
+        *stats = s;
+    }
+}
+
+#endif
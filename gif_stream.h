@@ -0,0 +1,481 @@
+/*
+Streaming encoder: frames are pushed one at a time and written out as they come
+
+Only two frames are held: the last pushed one (held back in case the next one is the same, then
+the two become one frame with both delay times) and the one before it, which is what the viewer
+shows underneath. A frame is encoded as the rectangle of pixels that differ from the one before,
+with the unchanged pixels inside it made transparent (or left in their color where that makes
+the LZW strings longer), and is written to the stream as soon as flush_bytes have been collected,
+in one write. Memory use doesn't depend on the length of the animation. With start_threads(),
+LZW compression and writing run on threads of their own while the next frame is quantized.
+
+With a global color table (see plan_palette() in gif_palette.h), frames pushed without a local
+table of their own are mapped onto it instead of being quantized.
+*/
+
+#ifndef GIF_STREAM_H
+#define GIF_STREAM_H
+
+#include "gif.h"
+#include "gif_canvas.h"
+#include "gif_encode.h"
+#include "gif_lossy.h"
+#include "gif_optimal.h"
+#include "gif_queue.h"
+
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <thread>
+
+struct StreamStats
+{
+    size_t frames_pushed = 0;
+    size_t frames_written = 0; // fewer if identical frames were merged
+    size_t frames_global = 0; // written with the global color table
+    size_t bytes_written = 0;
+    size_t transparency_saved = 0; // bytes saved by unchanged pixels keeping their color (estimated for plain LZW)
+};
+
+/* A frame that has been compared and quantized, ready for LZW */
+struct StreamFrame
+{
+    Rect rect;
+    std::vector<Color> lct; // empty to use the global color table
+    size_t ncolors; // how many colors the indices can refer to
+    int delay_time;
+    int trans; // transparent index, -1 if there's none
+    std::vector<uint8_t> indices;
+};
+
+class StreamEncoder
+{
+public:
+    /* Only the first 255 colors of gct are used, the index after them is used for transparency */
+    StreamEncoder(std::ostream& file_, size_t width_, size_t height_, int loop_count = 0, const std::vector<Color>& gct_ = std::vector<Color>())
+        : file(file_), width(width_), height(height_), gct(gct_.begin(), gct_.begin() + std::min<size_t>(gct_.size(), 255))
+    {
+        if (!gct.empty())
+        {
+            std::vector<Color> table = gct;
+            table.push_back(Color{0, 0, 0}); // transparent
+
+            write_header(buffer, width, height, table);
+
+            for (size_t i = 0; i < gct.size(); ++i)
+            {
+                gct_exact.emplace(color_rgba(gct[i].r, gct[i].g, gct[i].b, 255) & 0xFFFFFF, i);
+            }
+
+            gct_nearest.assign(0x8000, -1);
+        }
+        else
+        {
+            write_header(buffer, width, height, gct);
+        }
+
+        if (loop_count >= 0)
+        {
+            write_netscape(buffer, loop_count);
+        }
+
+        flush(buffer);
+    }
+
+    ~StreamEncoder()
+    {
+        stop_threads();
+    }
+
+    /*
+    Compress and write frames on two threads of their own, connected to push() (where frames are
+    compared and quantized) by queues of queue_size frames. Call it before the first push().
+    */
+    void start_threads(size_t queue_size = 4)
+    {
+        lzw_queue.reset(new BoundedQueue<StreamFrame>(queue_size));
+        write_queue.reset(new BoundedQueue<std::vector<uint8_t>>(queue_size));
+
+        lzw_thread = std::thread([this]()
+        {
+            StreamFrame f;
+
+            while (lzw_queue->pop(f))
+            {
+                std::vector<uint8_t> bytes;
+                encode_frame(f, bytes);
+
+                if (!write_queue->push(std::move(bytes)))
+                {
+                    break;
+                }
+            }
+
+            write_queue->close();
+        });
+
+        write_thread = std::thread([this]()
+        {
+            std::vector<uint8_t> bytes;
+
+            while (write_queue->pop(bytes))
+            {
+                if (!flush(bytes))
+                {
+                    failed = true;
+                    lzw_queue->close(); // push() fails from now on
+                    write_queue->close();
+                }
+            }
+        });
+    }
+
+    /*
+    Add a frame of width x height BGRA pixels (see color_rgba) shown for delay_time centiseconds.
+    Without a global color table, every frame gets a local one.
+    */
+    bool push(const uint32_t* pixels, int delay_time, bool local = true)
+    {
+        stats.frames_pushed++;
+
+        if (has_pending && std::equal(pixels, pixels + width * height, pending.begin()))
+        {
+            pending_delay = std::min(pending_delay + delay_time, 0xFFFF);
+            return true;
+        }
+
+        if (has_pending && !write_pending())
+        {
+            return false;
+        }
+
+        pending.assign(pixels, pixels + width * height);
+        pending_delay = delay_time;
+        pending_local = local || gct.empty();
+        has_pending = true;
+
+        return true;
+    }
+
+    /* Compress and write a frame captured by another encoder of the same size (without threads) */
+    bool push_prepared(const StreamFrame& f)
+    {
+        stats.frames_written++;
+        stats.frames_global += f.lct.empty();
+
+        encode_frame(f, buffer);
+        return buffer.size() < flush_bytes || flush(buffer);
+    }
+
+    /* Write the last frame and the trailer, nothing can be pushed afterwards */
+    bool finish()
+    {
+        bool ok = !has_pending || write_pending();
+
+        stop_threads();
+
+        buffer.push_back(0x3B);
+        return flush(buffer) && ok && !failed;
+    }
+
+    StreamStats stats; // bytes_written is only complete once finish() returns
+    size_t optimize = 0; // candidate positions per frame for lzw_encode_optimal(), 0 for plain LZW
+    int lossy = 0; // lossy level for lzw_encode_lossy() (takes precedence over optimize), 0 for exact colors
+    size_t flush_bytes = 1 << 16; // without threads, frames are collected until there's this much to write, 0 writes every frame right away
+    bool keep_colors = true; // let unchanged pixels keep their color where that compresses better than transparency
+    int max_colors = 256; // per local color table
+    std::vector<StreamFrame>* capture = nullptr; // if set, frames are collected here instead of compressed, see push_prepared()
+
+private:
+    /* Encode pending as the difference to shown and make it the shown frame */
+    bool write_pending()
+    {
+        Rect r{0, 0, int(width), int(height)};
+        bool first = shown.empty();
+
+        if (!first)
+        {
+            // rectangle of the changed pixels
+            int x0 = r.width, y0 = r.height, x1 = -1, y1 = -1;
+
+            for (int y = 0; y < r.height; ++y)
+            {
+                const uint32_t* a = &shown[size_t(y) * width];
+                const uint32_t* b = &pending[size_t(y) * width];
+                int left = 0, right = r.width - 1;
+
+                while (left < r.width && a[left] == b[left])
+                {
+                    left++;
+                }
+
+                if (left == r.width)
+                {
+                    continue;
+                }
+
+                while (a[right] == b[right])
+                {
+                    right--;
+                }
+
+                x0 = std::min(x0, left);
+                x1 = std::max(x1, right);
+                y0 = std::min(y0, y);
+                y1 = y;
+            }
+
+            // push() merges identical frames, but the one after a merge can still match what's shown
+            r = x1 < 0 ? Rect{0, 0, 1, 1} : Rect{x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+        }
+
+        // quantize only the pixels that change, the others become the transparent index
+        changed.clear();
+        mask.assign(size_t(r.width) * r.height, 0);
+
+        for (int y = 0; y < r.height; ++y)
+        {
+            size_t row = size_t(r.top + y) * width + r.left;
+
+            for (int x = 0; x < r.width; ++x)
+            {
+                if (first || shown[row + x] != pending[row + x])
+                {
+                    changed.push_back(pending[row + x]);
+                    mask[size_t(y) * r.width + x] = 1;
+                }
+            }
+        }
+
+        bool transparent = changed.size() < mask.size();
+        int trans;
+
+        if (pending_local)
+        {
+            quantize(changed.data(), changed.size(), std::min(max_colors, transparent ? 255 : 256), palette, changed_indices);
+            trans = palette.size();
+        }
+        else
+        {
+            map_global(changed, changed_indices);
+            trans = gct.size();
+        }
+
+        indices.resize(mask.size());
+
+        for (size_t i = 0, k = 0; i < mask.size(); ++i)
+        {
+            indices[i] = mask[i] ? changed_indices[k++] : trans;
+        }
+
+        if (transparent && keep_colors)
+        {
+            choose_transparency(r, trans);
+        }
+
+        frame.rect = r;
+        frame.delay_time = pending_delay;
+        frame.trans = transparent ? trans : -1;
+        frame.indices.swap(indices);
+
+        if (pending_local)
+        {
+            size_t ncolors = palette.size() + (transparent ? 1 : 0);
+            palette.resize(std::max<size_t>(ncolors, 1), Color{0, 0, 0});
+            frame.lct = palette;
+            frame.ncolors = palette.size();
+        }
+        else
+        {
+            frame.lct.clear();
+            frame.ncolors = gct.size() + 1;
+            stats.frames_global++;
+        }
+
+        if (first)
+        {
+            shown.resize(width * height);
+        }
+
+        for (int y = 0; y < r.height; ++y)
+        {
+            size_t row = size_t(r.top + y) * width + r.left;
+            std::copy(&pending[row], &pending[row] + r.width, &shown[row]);
+        }
+
+        has_pending = false;
+        stats.frames_written++;
+
+        if (capture != nullptr)
+        {
+            capture->push_back(frame);
+            indices.swap(frame.indices);
+            return true;
+        }
+
+        if (lzw_queue)
+        {
+            return lzw_queue->push(std::move(frame));
+        }
+
+        encode_frame(frame, buffer);
+        indices.swap(frame.indices); // kept for the next frame
+
+        return buffer.size() < flush_bytes || flush(buffer);
+    }
+
+    /*
+    Unchanged pixels whose color is in the color table can be written in that color instead of
+    the transparent index. lzw_choose_indices() picks one of the two for each of them, the result
+    is kept if it's smaller.
+    */
+    void choose_transparency(const Rect& r, int trans)
+    {
+        const std::unordered_map<uint32_t, uint8_t>* exact = &gct_exact;
+
+        if (pending_local)
+        {
+            palette_exact.clear();
+
+            for (size_t i = 0; i < palette.size(); ++i)
+            {
+                palette_exact.emplace(color_rgba(palette[i].r, palette[i].g, palette[i].b, 255) & 0xFFFFFF, i);
+            }
+
+            exact = &palette_exact;
+        }
+
+        alt = indices;
+
+        for (int y = 0; y < r.height; ++y)
+        {
+            size_t row = size_t(r.top + y) * width + r.left;
+
+            for (int x = 0; x < r.width; ++x)
+            {
+                size_t i = size_t(y) * r.width + x;
+
+                if (!mask[i])
+                {
+                    auto it = exact->find(pending[row + x] & 0xFFFFFF);
+
+                    if (it != exact->end())
+                    {
+                        alt[i] = it->second;
+                    }
+                }
+            }
+        }
+
+        int lzw_min = lzw_min_code_size(trans + 1);
+        size_t before = lzw_choose_indices(indices.data(), nullptr, indices.size(), lzw_min);
+
+        chosen = indices;
+
+        size_t after = lzw_choose_indices(chosen.data(), alt.data(), chosen.size(), lzw_min);
+
+        if (after < before)
+        {
+            indices.swap(chosen);
+            stats.transparency_saved += (before - after) / 8;
+        }
+    }
+
+    /* Graphic control extension, image descriptor and compressed indices of f (on the LZW thread if there is one) */
+    void encode_frame(const StreamFrame& f, std::vector<uint8_t>& out) const
+    {
+        const Rect& r = f.rect;
+        int lzw_min = lzw_min_code_size(f.ncolors);
+
+        write_graphics_control(out, 1, f.delay_time, f.trans >= 0, f.trans >= 0 ? f.trans : 0);
+        write_image_descriptor(out, r.left, r.top, r.width, r.height, f.lct);
+
+        if (lossy > 0)
+        {
+            lzw_encode_lossy(f.indices.data(), f.indices.size(), lzw_min, f.lct.empty() ? gct : f.lct, f.trans, lossy, out);
+        }
+        else if (optimize > 0)
+        {
+            lzw_encode_optimal(f.indices.data(), f.indices.size(), lzw_min, out, 1, optimize);
+        }
+        else
+        {
+            lzw_encode(f.indices.data(), f.indices.size(), lzw_min, out);
+        }
+    }
+
+    void stop_threads()
+    {
+        if (lzw_thread.joinable())
+        {
+            lzw_queue->close();
+            lzw_thread.join();
+            write_thread.join();
+        }
+    }
+
+    /* Exact matches in the global color table, otherwise the nearest entry of the 15-bit bin */
+    void map_global(const std::vector<uint32_t>& pixels, std::vector<uint8_t>& out)
+    {
+        out.resize(pixels.size());
+
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            uint32_t p = pixels[i];
+            auto it = gct_exact.find(p & 0xFFFFFF);
+
+            if (it != gct_exact.end())
+            {
+                out[i] = it->second;
+                continue;
+            }
+
+            int key = color_key15(p);
+
+            if (gct_nearest[key] < 0)
+            {
+                gct_nearest[key] = nearest_color(gct, Color{uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p)});
+            }
+
+            out[i] = gct_nearest[key];
+        }
+    }
+
+    bool flush(std::vector<uint8_t>& bytes)
+    {
+        file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        stats.bytes_written += bytes.size();
+        bytes.clear();
+
+        return bool(file);
+    }
+
+    std::ostream& file;
+    size_t width, height;
+
+    std::vector<uint32_t> shown; // pushed pixels behind what the viewer shows after the frames written so far
+    std::vector<uint32_t> pending; // last pushed frame, not written yet
+    int pending_delay = 0;
+    bool pending_local = true;
+    bool has_pending = false;
+
+    std::vector<Color> gct;
+    std::unordered_map<uint32_t, uint8_t> gct_exact;
+    std::vector<int16_t> gct_nearest; // filled lazily
+
+    // kept from one frame to the next
+    std::vector<uint8_t> buffer; // encoded frames before they're written, sub-blocks framed in place by LZWWriter
+    std::vector<uint32_t> changed;
+    std::vector<uint8_t> mask, indices, changed_indices, alt, chosen;
+    std::vector<Color> palette;
+    std::unordered_map<uint32_t, uint8_t> palette_exact;
+    StreamFrame frame;
+
+    // with start_threads()
+    std::unique_ptr<BoundedQueue<StreamFrame>> lzw_queue;
+    std::unique_ptr<BoundedQueue<std::vector<uint8_t>>> write_queue;
+    std::thread lzw_thread, write_thread;
+    std::atomic<bool> failed{false};
+};
+
+#endif